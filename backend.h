@@ -0,0 +1,28 @@
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+#include <stdint.h>
+#include "config.h"
+
+//Most bytes one program operation takes, they must not cross the
+//border of a page. The internal EEPROM is programmed a byte at a time.
+#if STORAGE_BACKEND == BACKEND_INTERNAL
+#define BACKEND_PAGE	1
+#else
+#define BACKEND_PAGE	STORAGE_PAGE
+#endif
+
+//Results of backend_program()
+#define BACKEND_SAME		0
+#define BACKEND_STARTED		1
+#define BACKEND_FAILED		2
+
+void backend_init(void);
+
+uint8_t backend_read(uint16_t addr);
+
+uint8_t backend_program(uint16_t addr, const uint8_t* data, uint8_t len);
+
+uint8_t backend_busy(void);
+
+#endif /* BACKEND_H_ */
@@ -0,0 +1,171 @@
+#include <avr/io.h>
+#include <util/twi.h>
+#include "config.h"
+#include "backend.h"
+
+#if STORAGE_BACKEND == BACKEND_I2C
+
+//24LC32 to 24LC512 with A2..A0 tied low, addressed with two bytes.
+//TWBR has to stay at 10 or above, that limits SCL to 333 kHz
+#define EEPROM_SLA		0xA0
+#define I2C_CLOCK		100000L
+//Attempts at the bus address before the EEPROM is taken as missing. Each
+//one takes about 100 us, a page write keeps the EEPROM silent for 5 ms
+#define I2C_RETRIES		200
+//Times a page is sent again when the EEPROM refuses a byte of it
+#define PAGE_RETRIES	3
+
+//Set once the EEPROM did not answer any of I2C_RETRIES attempts, it is
+//only tried once then so that a missing chip does not stall the firmware
+static uint8_t missing;
+//Busy polls the EEPROM has not answered in a row
+static uint8_t polls;
+
+//Starts a TWI operation and returns the bus status when it is done
+static uint8_t twi_command(uint8_t command) {
+	TWCR = command | _BV(TWINT) | _BV(TWEN);
+	while (!(TWCR & _BV(TWINT)))
+		;
+	return TW_STATUS;
+}
+
+static void twi_stop(void) {
+	TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+	while (TWCR & _BV(TWSTO))
+		;
+}
+
+//Sends a start condition and the bus address.
+//Returns 1 if the EEPROM answered, it does not while programming a page
+static uint8_t twi_start(uint8_t sla) {
+	uint8_t status = twi_command(_BV(TWSTA));
+
+	if ((status != TW_START) && (status != TW_REP_START)) {
+		return 0;
+	}
+	TWDR = sla;
+	status = twi_command(0);
+	return (status == TW_MT_SLA_ACK) || (status == TW_MR_SLA_ACK);
+}
+
+//Sends a byte, returns 1 if the EEPROM acknowledged it
+static uint8_t twi_write(uint8_t value) {
+	TWDR = value;
+	return twi_command(0) == TW_MT_DATA_ACK;
+}
+
+//Reads a byte, more tells the EEPROM another one is wanted after it
+static uint8_t twi_read(uint8_t more) {
+	twi_command(more ? _BV(TWEA) : 0);
+	return TWDR;
+}
+
+//Waits for the EEPROM and sends it addr.
+//Returns 0 if it did not answer
+static uint8_t address(uint16_t addr) {
+	uint8_t tries = missing ? 1 : I2C_RETRIES;
+
+	while (!twi_start(EEPROM_SLA | TW_WRITE) || !twi_write(addr >> 8)
+			|| !twi_write(addr & 0xFF)) {
+		twi_stop();
+		if (--tries == 0) {
+			missing = 1;
+			return 0;
+		}
+	}
+	missing = 0;
+	return 1;
+}
+
+//Sends addr and turns the bus round to read from there. Whatever part
+//is not answered, it is all tried again from a stop condition.
+//Returns 0 if the EEPROM did not answer
+static uint8_t address_read(uint16_t addr) {
+	uint8_t tries = I2C_RETRIES;
+
+	while (address(addr)) {
+		if (twi_start(EEPROM_SLA | TW_READ)) {
+			return 1;
+		}
+		twi_stop();
+		if (--tries == 0) {
+			break;
+		}
+	}
+	return 0;
+}
+
+void backend_init(void) {
+	TWSR = 0;
+	TWBR = (F_CPU / I2C_CLOCK - 16) / 2;
+	missing = 0;
+	polls = 0;
+}
+
+//An EEPROM that does not answer reads as erased
+uint8_t backend_read(uint16_t addr) {
+	uint8_t value;
+
+	if (!address_read(addr)) {
+		return 0xFF;
+	}
+	value = twi_read(0);
+	twi_stop();
+	return value;
+}
+
+//Starts a page write of len bytes at addr, all in one page.
+//Returns BACKEND_SAME if the EEPROM already holds them, nothing is
+//written then, and BACKEND_FAILED if it does not take them
+uint8_t backend_program(uint16_t addr, const uint8_t* data, uint8_t len) {
+	uint8_t same = 1;
+	uint8_t tries;
+	uint8_t i;
+
+	if (!address_read(addr)) {
+		return BACKEND_FAILED;
+	}
+	for (i = 0; i < len; i++) {
+		if (twi_read(i + 1 < len) != data[i]) {
+			same = 0;
+		}
+	}
+	twi_stop();
+	if (same) {
+		return BACKEND_SAME;
+	}
+
+	//The page is programmed after the stop condition. A byte that is not
+	//acknowledged leaves it short, the whole page is sent again then
+	for (tries = PAGE_RETRIES; tries != 0; tries--) {
+		if (!address(addr)) {
+			break;
+		}
+		for (i = 0; (i < len) && twi_write(data[i]); i++)
+			;
+		twi_stop();
+		if (i == len) {
+			return BACKEND_STARTED;
+		}
+	}
+	return BACKEND_FAILED;
+}
+
+//Acknowledge polling, the EEPROM answers again once the page is written.
+//One that stays silent is given up on, programming it then fails
+uint8_t backend_busy(void) {
+	uint8_t ready = twi_start(EEPROM_SLA | TW_WRITE);
+
+	twi_stop();
+	if (ready) {
+		missing = 0;
+		polls = 0;
+	} else if (polls < I2C_RETRIES) {
+		polls++;
+	} else {
+		missing = 1;
+	}
+	return !ready && !missing;
+}
+
+#endif
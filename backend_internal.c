@@ -0,0 +1,44 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "config.h"
+#include "backend.h"
+
+#if STORAGE_BACKEND == BACKEND_INTERNAL
+
+void backend_init(void) {
+}
+
+//Waits for the byte being programmed and reads addr
+uint8_t backend_read(uint16_t addr) {
+	while (EECR & _BV(EEWE))
+		;
+	EEAR = addr;
+	EECR |= _BV(EERE);
+	return EEDR;
+}
+
+//Starts programming a byte, len is always 1.
+//Returns BACKEND_SAME if the EEPROM already holds it, nothing is
+//programmed then
+uint8_t backend_program(uint16_t addr, const uint8_t* data, uint8_t len) {
+	uint8_t sreg;
+
+	if (backend_read(addr) == *data) {
+		return BACKEND_SAME;
+	}
+
+	EEDR = *data;
+	//EEWE has to follow EEMWE within four cycles
+	sreg = SREG;
+	cli();
+	EECR |= _BV(EEMWE);
+	EECR |= _BV(EEWE);
+	SREG = sreg;
+	return BACKEND_STARTED;
+}
+
+uint8_t backend_busy(void) {
+	return EECR & _BV(EEWE);
+}
+
+#endif
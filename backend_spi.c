@@ -0,0 +1,98 @@
+#include <avr/io.h>
+#include "config.h"
+#include "backend.h"
+
+#if STORAGE_BACKEND == BACKEND_SPI
+
+//25LC320 to 25LC512 on the SPI pins, chip select on SS.
+//SS has to be an output for the SPI to stay master
+#define CS_PIN			PB4
+#define MOSI_PIN		PB5
+#define SCK_PIN			PB7
+
+#define chip_select()	(PORTB &= ~_BV(CS_PIN))
+#define chip_release()	(PORTB |= _BV(CS_PIN))
+
+//Instructions of the EEPROM
+#define CMD_READ		0x03
+#define CMD_WRITE		0x02
+#define CMD_WREN		0x06
+#define CMD_RDSR		0x05
+//Status register bit set while a page is programmed
+#define STATUS_WIP		(1<<0)
+
+static uint8_t spi_transfer(uint8_t value) {
+	SPDR = value;
+	while (!(SPSR & _BV(SPIF)))
+		;
+	return SPDR;
+}
+
+//Waits for the EEPROM and sends it an instruction with addr
+static void command(uint8_t cmd, uint16_t addr) {
+	while (backend_busy())
+		;
+	chip_select();
+	spi_transfer(cmd);
+	spi_transfer(addr >> 8);
+	spi_transfer(addr & 0xFF);
+}
+
+//SPI master in mode 0 at F_CPU / 4
+void backend_init(void) {
+	chip_release();
+	DDRB |= _BV(CS_PIN) | _BV(MOSI_PIN) | _BV(SCK_PIN);
+	SPCR = _BV(SPE) | _BV(MSTR);
+}
+
+uint8_t backend_read(uint16_t addr) {
+	uint8_t value;
+
+	command(CMD_READ, addr);
+	value = spi_transfer(0);
+	chip_release();
+	return value;
+}
+
+//Starts a page write of len bytes at addr, all in one page.
+//Returns BACKEND_SAME if the EEPROM already holds them, nothing is
+//written then
+uint8_t backend_program(uint16_t addr, const uint8_t* data, uint8_t len) {
+	uint8_t same = 1;
+	uint8_t i;
+
+	command(CMD_READ, addr);
+	for (i = 0; i < len; i++) {
+		if (spi_transfer(0) != data[i]) {
+			same = 0;
+		}
+	}
+	chip_release();
+	if (same) {
+		return BACKEND_SAME;
+	}
+
+	chip_select();
+	spi_transfer(CMD_WREN);
+	chip_release();
+
+	command(CMD_WRITE, addr);
+	for (i = 0; i < len; i++) {
+		spi_transfer(data[i]);
+	}
+	//The page is programmed once the chip is released
+	chip_release();
+	return BACKEND_STARTED;
+}
+
+uint8_t backend_busy(void) {
+	uint8_t status;
+
+	chip_select();
+	spi_transfer(CMD_RDSR);
+	status = spi_transfer(0);
+	chip_release();
+	return status & STATUS_WIP;
+}
+
+#endif
@@ -10,13 +10,46 @@
 
 #define F_CPU 12000000L
 
+//Memory the vault is kept in
+#define BACKEND_INTERNAL		0	//EEPROM of the ATmega16
+#define BACKEND_I2C				1	//24LC series EEPROM on SCL and SDA
+#define BACKEND_SPI				2	//25 series EEPROM on the SPI pins
+#define STORAGE_BACKEND			BACKEND_INTERNAL
+
+//Bytes of the memory given to the vault, 512 at most for the internal
+//EEPROM and 32768 for an external one. The list stays limited to 64
+//passwords by its index in RAM
+#define STORAGE_SIZE			512
+//Write page of an external EEPROM: 32 bytes for the 24LC32/64 and
+//25LC320/640, 64 bytes for the 24LC256 and 25LC256
+#define STORAGE_PAGE			32
+
 //Address in the eeprom to start storing the password
 #define EEPROM_START_ADDRESS	0
 //This is a hash code kept in the eeprom to confirm an eeprom valid state
 #define EEPROM_HASH				0xAA
+//Address of the host keyboard layout setting, the last EEPROM byte
+#define EEPROM_LAYOUT_ADDRESS	(STORAGE_SIZE - 1)
+
+//Set to 1 to start a new vault with a slot directory, which finds any
+//password right away, instead of the log spreading the EEPROM writes
+#define VAULT_USE_SLOTS			0
+
+//Set to 0 to store new passwords unpacked. Packed passwords take 6 bits
+//for a letter or digit and 14 bits for anything else
+#define VAULT_PACKING			1
 
 #define DEBOUNCE_PERIOD			200
 
-#define PASSWORD_MAX_LENGTH		16
+//Characters typed on the PS/2 keyboard that are not read yet, must be
+//a power of two up to 128
+#define KB_BUFFER_SIZE			16
+
+//Longest entry that can be typed in, fills both lines of the LCD
+#define PASSWORD_MAX_LENGTH		32
+
+//Number of distinct keys packed into one HID report while typing (1..6)
+//Use 1 for hosts that do not handle several new keys in one report
+#define KEYS_PER_REPORT			6
 
 #endif /* CONFIG_H_ */
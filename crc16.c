@@ -0,0 +1,15 @@
+#include <avr/pgmspace.h>
+#include "crc16.h"
+
+//CRC-16/CCITT (polynomial 0x1021) of every nibble value, a byte takes
+//two table lookups instead of eight shifts
+static const uint16_t crc_table[16] PROGMEM = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+uint16_t crc16_update(uint16_t crc, uint8_t data) {
+	crc = (crc << 4) ^ pgm_read_word(&crc_table[(crc >> 12) ^ (data >> 4)]);
+	crc = (crc << 4) ^ pgm_read_word(&crc_table[(crc >> 12) ^ (data & 0x0F)]);
+	return crc;
+}
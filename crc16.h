@@ -0,0 +1,11 @@
+#ifndef CRC16_H_
+#define CRC16_H_
+
+#include <stdint.h>
+
+//Starting value of a checksum
+#define CRC16_INIT		0xFFFF
+
+uint16_t crc16_update(uint16_t crc, uint8_t data);
+
+#endif /* CRC16_H_ */
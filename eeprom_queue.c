@@ -0,0 +1,139 @@
+#include <avr/io.h>
+#include "config.h"
+#include "eeprom_queue.h"
+#include "backend.h"
+
+//Bytes waiting to be programmed, kept as runs of consecutive addresses
+//in the order they were written. The data of the runs follows each
+//other in a separate ring.
+#define QUEUE_RUNS		8
+#define QUEUE_DATA		64
+
+typedef struct {
+	uint16_t addr;
+	uint8_t len;
+} ee_run_t;
+
+static ee_run_t runs[QUEUE_RUNS];
+static uint8_t data[QUEUE_DATA];
+
+//Free running, the heads are moved by ee_write_byte() and the tails by
+//ee_poll()
+static uint8_t run_head;
+static uint8_t run_tail;
+static uint8_t data_head;
+static uint8_t data_tail;
+//Set when bytes could not be programmed
+static uint8_t failed;
+
+//Takes the oldest bytes of the queue, as many as follow each other in
+//the same page, and starts programming them.
+//Returns the result of backend_program(), the bytes are dropped from the
+//queue whatever it is
+static uint8_t queue_program(void) {
+	ee_run_t* run = &runs[run_tail % QUEUE_RUNS];
+	uint8_t page[BACKEND_PAGE];
+	uint16_t addr = run->addr;
+	uint8_t n = BACKEND_PAGE - addr % BACKEND_PAGE;
+	uint8_t i;
+
+	if (n > run->len) {
+		n = run->len;
+	}
+	for (i = 0; i < n; i++) {
+		page[i] = data[data_tail % QUEUE_DATA];
+		data_tail++;
+	}
+	run->addr += n;
+	run->len -= n;
+	if (run->len == 0) {
+		run_tail++;
+	}
+
+	return backend_program(addr, page, n);
+}
+
+//Queues a byte for programming, waits only while the queue is full
+void ee_write_byte(uint16_t addr, uint8_t value) {
+	ee_run_t* run = &runs[(uint8_t) (run_head - 1) % QUEUE_RUNS];
+
+	while (((uint8_t) (data_head - data_tail) == QUEUE_DATA)
+			|| ((uint8_t) (run_head - run_tail) == QUEUE_RUNS)) {
+		ee_poll();
+	}
+
+	if ((run_head == run_tail) || (run->addr + run->len != addr)
+			|| (run->len == UINT8_MAX)) {
+		run = &runs[run_head % QUEUE_RUNS];
+		run->addr = addr;
+		run->len = 0;
+		run_head++;
+	}
+	run->len++;
+	data[data_head % QUEUE_DATA] = value;
+	data_head++;
+}
+
+//Reads a byte as it will be once the queue is programmed
+uint8_t ee_read_byte(uint16_t addr) {
+	uint8_t pos = data_tail;
+	uint8_t i;
+	uint8_t found = 0;
+	uint8_t value = 0;
+
+	//The newest write of the address counts
+	for (i = run_tail; i != run_head; i++) {
+		ee_run_t* run = &runs[i % QUEUE_RUNS];
+
+		if ((uint16_t) (addr - run->addr) < run->len) {
+			value = data[(uint8_t) (pos + addr - run->addr) % QUEUE_DATA];
+			found = 1;
+		}
+		pos += run->len;
+	}
+
+	if (!found) {
+		value = backend_read(addr);
+	}
+
+	return value;
+}
+
+//Returns 1 while bytes are waiting to be programmed
+uint8_t ee_pending(void) {
+	return run_head != run_tail;
+}
+
+//Programs the queue as far as the memory is ready, the internal EEPROM
+//gets a byte and an external one a page at a time. Call it from the
+//main loop, the EEPROM is polled rather than served by EE_READY as that
+//interrupt would keep the others off longer than USB allows.
+void ee_poll(void) {
+	uint8_t result;
+
+	while ((run_head != run_tail) && !backend_busy()) {
+		result = queue_program();
+		if (result == BACKEND_FAILED) {
+			failed = 1;
+		}
+		if (result != BACKEND_SAME) {
+			break;
+		}
+	}
+}
+
+//Returns when everything written so far is in the EEPROM
+void ee_flush(void) {
+	while (ee_pending() || backend_busy()) {
+		ee_poll();
+	}
+}
+
+//Returns 1 if bytes were lost as the memory did not take them since the
+//last call
+uint8_t ee_failed(void) {
+	uint8_t result = failed;
+
+	failed = 0;
+	return result;
+}
@@ -0,0 +1,18 @@
+#ifndef EEPROM_QUEUE_H_
+#define EEPROM_QUEUE_H_
+
+#include <stdint.h>
+
+void ee_write_byte(uint16_t addr, uint8_t value);
+
+uint8_t ee_read_byte(uint16_t addr);
+
+uint8_t ee_pending(void);
+
+void ee_poll(void);
+
+void ee_flush(void);
+
+uint8_t ee_failed(void);
+
+#endif /* EEPROM_QUEUE_H_ */
@@ -1,10 +1,15 @@
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
+#include "config.h"
 #include "scancodes.h"
 #include "keyboard.h"
+#include "timer.h"
 
-#define BUFF_SIZE 16
+#define BUFF_MASK (KB_BUFFER_SIZE - 1)
+// Scancodes waiting to be decoded, must be a power of two
+#define RAW_SIZE 16
+#define RAW_MASK (RAW_SIZE - 1)
 #define DDR_CLOCK DDRB
 #define PORT_CLOCK PORTB
 #define PIN_CLOCK PINB
@@ -18,37 +23,116 @@
 #define TRUE 1
 #define FALSE 0
 
+// The lines are open collector, a 0 is sent by driving the line low
+#define data_low() (DDR_DATA |= (1 << DATA_PIN))
+#define data_release() (DDR_DATA &= ~(1 << DATA_PIN))
+
+// Commands to the keyboard and its replies
+#define CMD_LEDS 0xED
+#define CMD_TYPEMATIC 0xF3
+#define CMD_RESET 0xFF
+#define REPLY_ACK 0xFA
+#define REPLY_RESEND 0xFE
+#define REPLY_SELF_TEST_OK 0xAA
+// Only the reset takes no parameter
+#define command_length(cmd) (((cmd) == CMD_RESET) ? 1 : 2)
+
+// Bytes waiting to be sent to the keyboard, must be a power of two
+#define TX_SIZE 8
+#define TX_MASK (TX_SIZE - 1)
+// A byte not acknowledged in REPLY_TIMEOUT ms is sent again, after
+// TX_TRIES tries the command is dropped. The keyboard may take 15 ms to
+// start clocking, 2 ms for the byte and 20 ms more for its reply
+#define REPLY_TIMEOUT 40
+#define TX_TRIES 3
+
 static void put_kbbuff(unsigned char c);
 
 static volatile uint8_t bitcount, toDevice;
-static volatile uint8_t buffcnt = 0;
-static uint8_t kb_buffer[BUFF_SIZE];
-static uint8_t *inpt, *outpt;
+
+// Ring of decoded characters. inpt and outpt run freely, the number of
+// characters in it is (inpt - outpt)
+static uint8_t kb_buffer[KB_BUFFER_SIZE];
+static uint8_t inpt, outpt;
+
+// Set while text is typed in, the characters are only kept then
+static uint8_t input;
+
+// Characters dropped because kb_buffer was full and scancodes dropped
+// because raw was full, both stop at 255
+static uint8_t lost_chars;
+static volatile uint8_t lost_scancodes;
+
+// Ring of received scancodes. raw_head and raw_tail run freely, the
+// interrupt only moves raw_head and kb_poll() only raw_tail
+static uint8_t raw[RAW_SIZE];
+static volatile uint8_t raw_head, raw_tail;
+
+// Ring of bytes to send, only used by the main loop. The byte at tx_tail
+// is on its way while tx_waiting is set, since tx_start. tx_command is
+// where the command it belongs to starts
+static uint8_t tx_queue[TX_SIZE];
+static uint8_t tx_head, tx_tail, tx_command;
+static uint8_t tx_waiting, tx_tries;
+static uint16_t tx_start;
+
+// Byte being shifted out by the interrupt, the number of bits already
+// sent and the odd parity of them
+static volatile uint8_t tx_byte, tx_bit, tx_parity;
+
+// Settings sent to the keyboard, they are sent again after it resets.
+// A setting the keyboard did not take is stale, it is sent again with
+// the next call even when it is the same
+#define STALE_LEDS (1 << 0)
+#define STALE_TYPEMATIC (1 << 1)
+static uint8_t leds;
+static uint8_t typematic = KB_TYPEMATIC_DEFAULT;
+static uint8_t stale;
 
 void ps2_init(void) {
 	bitcount = 11;
 	toDevice = FALSE;
+	// Both lines are released, no pull-ups
+	PORT_CLOCK &= ~(1 << CLOCK_PIN);
+	PORT_DATA &= ~(1 << DATA_PIN);
 	//enable INT2 interrupt
 	GICR |= (1 << INT2);
 	// INT2 interrupt on falling edge
 	MCUCSR = (0 << ISC2);
 }
 
+// Queues a command and its parameter, the reset has none. A command
+// that does not fit whole is not queued
+static void kb_send(uint8_t cmd, uint8_t param) {
+	uint8_t n = command_length(cmd);
+
+	if ((uint8_t) (TX_SIZE - (uint8_t) (tx_head - tx_tail)) < n) {
+		return;
+	}
+	tx_queue[tx_head & TX_MASK] = cmd;
+	tx_head++;
+	if (n > 1) {
+		tx_queue[tx_head & TX_MASK] = param;
+		tx_head++;
+	}
+}
+
 void kb_init(void) {
 	ps2_init();
 	kb_clear_buff();
+	// Whatever state the keyboard powered up in, start from its defaults
+	kb_send(CMD_RESET, 0);
 }
 
-// Initialize buffer
+// Initialize buffer, what was typed so far is dropped
 void kb_clear_buff(void) {
-	inpt = kb_buffer;
-	outpt = kb_buffer;
-	buffcnt = 0;
+	kb_poll();
+	outpt = inpt;
 }
 
-void decode(unsigned char sc) {
+static void decode(unsigned char sc) {
 	static unsigned char is_up = 0, shift = 0, ext = 0;
-	unsigned char i;
+	unsigned char c;
 
 	// previous data received was the up-key identifier
 	if (!is_up) {
@@ -74,38 +158,17 @@ void decode(unsigned char sc) {
 			break;
 
 		default:
-			//extended key lookup
-			if (ext) {
-
-				for (i = 0;
-						(pgm_read_byte(&extended[i][0]) != sc)
-								&& pgm_read_byte(&extended[i][0]); i++)
-					;
-				if (pgm_read_byte(&extended[i][0]) == sc)
-					put_kbbuff(pgm_read_byte(&extended[i][1]));
-			} else {
-
-				// If shift not pressed, do a table look-up
-				if (!shift) {
-					for (i = 0;
-							(pgm_read_byte(&unshifted[i][0]) != sc)
-									&& pgm_read_byte(&unshifted[i][0]); i++)
-						;
-					if (pgm_read_byte(&unshifted[i][0]) == sc)
-						put_kbbuff(pgm_read_byte(&unshifted[i][1]));
-
+			// One table read for the character of the key
+			if (sc < SCANCODES) {
+				if (ext) {
+					c = pgm_read_byte(&extended[sc]);
+				} else if (!shift) {
+					c = pgm_read_byte(&unshifted[sc]);
 				} else {
-
-					// If shift pressed
-					for (i = 0;
-							(pgm_read_byte(&shifted[i][0]) != sc)
-									&& pgm_read_byte(&shifted[i][0]); i++)
-						;
-					if (pgm_read_byte(&shifted[i][0]) == sc)
-						put_kbbuff(pgm_read_byte(&shifted[i][1]));
-
+					c = pgm_read_byte(&shifted[sc]);
 				}
-
+				if (c)
+					put_kbbuff(c);
 			}
 
 		}
@@ -134,47 +197,191 @@ void decode(unsigned char sc) {
 }
 
 static void put_kbbuff(unsigned char c) {
+	// Dropped without counting it as lost while no text is typed in
+	if (!input) {
+		return;
+	}
 	// If buffer not full
-	if (buffcnt < BUFF_SIZE) {
-		// Put character into buffer
-		*inpt = c;
-		// Increment pointer
+	if ((uint8_t) (inpt - outpt) < KB_BUFFER_SIZE) {
+		kb_buffer[inpt & BUFF_MASK] = c;
 		inpt++;
+	} else if (lost_chars < UINT8_MAX) {
+		lost_chars++;
+	}
+}
+
+// Starts sending the byte at tx_tail. The clock is held low for 100 us,
+// then the start bit goes on the data line and the clock is released.
+// The keyboard clocks the rest of the byte in, the interrupt puts the
+// bits on the line
+static void transmit(void) {
+	GICR &= ~(1 << INT2);
+	DDR_CLOCK |= (1 << CLOCK_PIN);
+	_delay_us(100);
+	data_low();
+
+	tx_byte = tx_queue[tx_tail & TX_MASK];
+	tx_bit = 0;
+	tx_parity = 1;
+	toDevice = TRUE;
+	// A scancode cut off by the clock is sent again by the keyboard
+	bitcount = 11;
+
+	DDR_CLOCK &= ~(1 << CLOCK_PIN);
+	// The falling edge made here is not a clock of the keyboard
+	GIFR = (1 << INTF2);
+	GICR |= (1 << INT2);
 
-		buffcnt++;
+	tx_waiting = TRUE;
+	tx_tries++;
+	tx_start = timer_ms();
+}
 
-		// Pointer wrapping
-		if (inpt >= (kb_buffer + BUFF_SIZE))
-			inpt = kb_buffer;
+// Decodes the scancodes received since the last call and sends the
+// queued commands, one byte at a time. Call it from the main loop often
+// enough for the ring not to fill, a lost key release would leave
+// shift held
+void kb_poll(void) {
+	uint8_t sc;
+
+	while (raw_tail != raw_head) {
+		memory_barrier();
+		sc = raw[raw_tail & RAW_MASK];
+		raw_tail++;
+
+		if (tx_waiting && (sc == REPLY_ACK)) {
+			tx_waiting = FALSE;
+			tx_tail++;
+			tx_tries = 0;
+			if ((uint8_t) (tx_tail - tx_command)
+					== command_length(tx_queue[tx_command & TX_MASK])) {
+				tx_command = tx_tail;
+			}
+		} else if (tx_waiting && (sc == REPLY_RESEND)) {
+			tx_waiting = FALSE;
+		} else if (sc == REPLY_SELF_TEST_OK) {
+			// The keyboard reset itself, it is back to its defaults
+			if (leds) {
+				kb_send(CMD_LEDS, leds);
+			}
+			if (typematic != KB_TYPEMATIC_DEFAULT) {
+				kb_send(CMD_TYPEMATIC, typematic);
+			}
+			stale = 0;
+		} else {
+			decode(sc);
+		}
+	}
+
+	if (tx_waiting && ((uint16_t) (timer_ms() - tx_start) > REPLY_TIMEOUT)) {
+		// No reply, the byte may not even have been clocked out
+		toDevice = FALSE;
+		data_release();
+		bitcount = 11;
+		tx_waiting = FALSE;
+	}
+
+	if (!tx_waiting && (tx_head != tx_tail)) {
+		if (tx_tries == TX_TRIES) {
+			// No keyboard or it does not take the command. The command is
+			// dropped with its parameter, so the next one is not taken for
+			// it, and its setting is sent again with the next call
+			switch (tx_queue[tx_command & TX_MASK]) {
+			case CMD_LEDS:
+				stale |= STALE_LEDS;
+				break;
+			case CMD_TYPEMATIC:
+				stale |= STALE_TYPEMATIC;
+				break;
+			}
+			tx_command += command_length(tx_queue[tx_command & TX_MASK]);
+			tx_tail = tx_command;
+			tx_tries = 0;
+		} else if (bitcount == 11) {
+			transmit();
+		}
 	}
 }
 
-uint8_t kb_get_char(void) {
-	uint8_t byte;
-	// Wait for data
-	while (buffcnt == 0)
-		;
+// Shows the lock states on the keyboard, state is made of KB_LED_ bits
+void kb_set_leds(uint8_t state) {
+	if ((state != leds) || (stale & STALE_LEDS)) {
+		leds = state;
+		stale &= ~STALE_LEDS;
+		kb_send(CMD_LEDS, state);
+	}
+}
 
-	// Get byte
-	byte = *outpt;
-	// Increment pointer
-	outpt++;
+// Sets the typematic rate and delay, see KB_TYPEMATIC_
+void kb_set_typematic(uint8_t rate) {
+	if ((rate != typematic) || (stale & STALE_TYPEMATIC)) {
+		typematic = rate;
+		stale &= ~STALE_TYPEMATIC;
+		kb_send(CMD_TYPEMATIC, rate);
+	}
+}
 
-	// Pointer wrapping
-	if (outpt >= (kb_buffer + BUFF_SIZE))
-		outpt = kb_buffer;
+// Keeps the characters typed from now on while on is set, they are
+// dropped otherwise. What was typed so far is dropped either way
+void kb_set_input(uint8_t on) {
+	kb_clear_buff();
+	input = on;
+}
+
+// Takes the next character typed, returns 0 if there is none yet
+uint8_t kb_try_get(uint8_t* c) {
+	kb_poll();
+	if (inpt == outpt) {
+		return 0;
+	}
 
-	// Decrement buffer count
-	buffcnt--;
+	*c = kb_buffer[outpt & BUFF_MASK];
+	outpt++;
+	return 1;
+}
 
-	return byte;
+// Returns the number of characters lost to a full buffer
+uint8_t kb_lost_chars(void) {
+	return lost_chars;
+}
 
+// Returns the number of scancodes lost because kb_poll() was not called
+// in time
+uint8_t kb_lost_scancodes(void) {
+	return lost_scancodes;
 }
 
-ISR(INT2_vect) {
+// Only assembles the bits of a scancode and queues it, decoding is left
+// to kb_poll(). While a byte is sent to the keyboard it puts the next
+// bit on the data line instead
+ISR(INT2_vect, ISR_NOBLOCK) {
 	static uint8_t byteIn;
 
-	sei();
+	if (toDevice) {
+		// The keyboard reads the line on the rising edge
+		if (tx_bit < 8) {
+			if (tx_byte & 1) {
+				data_release();
+				tx_parity ^= 1;
+			} else {
+				data_low();
+			}
+			tx_byte >>= 1;
+		} else if (tx_bit == 8) {
+			if (tx_parity)
+				data_release();
+			else
+				data_low();
+		} else if (tx_bit == 9) {
+			// Stop bit
+			data_release();
+		} else {
+			// The keyboard acknowledged the bits, its reply byte follows
+			toDevice = FALSE;
+		}
+		tx_bit++;
+		return;
+	}
 
 	//If data bit
 	if (bitcount > 2 && bitcount < 11) {
@@ -185,7 +392,14 @@ ISR(INT2_vect) {
 
 	//If scancode transfer complete
 	if (--bitcount == 0) {
-		decode(byteIn);
+		// A scancode is dropped if the ring is full
+		if ((uint8_t) (raw_head - raw_tail) < RAW_SIZE) {
+			raw[raw_head & RAW_MASK] = byteIn;
+			memory_barrier();
+			raw_head++;
+		} else if (lost_scancodes < UINT8_MAX) {
+			lost_scancodes++;
+		}
 		bitcount = 11;
 	}
 }
@@ -1,8 +1,24 @@
 #ifndef KEYBOARD_H_
 #define KEYBOARD_H_
 
+// Lock LEDs of the PS/2 keyboard
+#define KB_LED_SCROLL_LOCK (1 << 0)
+#define KB_LED_NUM_LOCK (1 << 1)
+#define KB_LED_CAPS_LOCK (1 << 2)
+
+// Typematic settings, the keyboard default repeats 10.9 times a second
+// after 500 ms, the fastest 30 times a second after 250 ms
+#define KB_TYPEMATIC_DEFAULT 0x2B
+#define KB_TYPEMATIC_FAST 0x00
+
 void kb_init(void);
 void kb_clear_buff(void);
-uint8_t kb_get_char(void);
+void kb_poll(void);
+uint8_t kb_try_get(uint8_t* c);
+uint8_t kb_lost_chars(void);
+uint8_t kb_lost_scancodes(void);
+void kb_set_leds(uint8_t state);
+void kb_set_typematic(uint8_t rate);
+void kb_set_input(uint8_t on);
 
 #endif /* KEYBOARD_H_ */
@@ -0,0 +1,135 @@
+#ifndef LAYOUTS_H_
+#define LAYOUTS_H_
+
+#include <avr/pgmspace.h>
+#include "typing.h"
+
+#define MOD_SHIFT	(1<<1)	//Left Shift
+#define MOD_ALTGR	(1<<6)	//Right Alt
+//Marks a dead key, the character is typed by following it with a space.
+//Right GUI is never sent, so its bit is free for the flag
+#define MOD_DEAD	(1<<7)
+
+//First and last character of the tables
+#define LAYOUT_FIRST_CHAR	' '
+#define LAYOUT_LAST_CHAR	'~'
+
+//Shorthands for the modifier and the HID usage of a table entry
+#define K(u)	0, u
+#define S(u)	MOD_SHIFT, u
+#define A(u)	MOD_ALTGR, u
+#define KD(u)	MOD_DEAD, u
+#define SD(u)	MOD_SHIFT | MOD_DEAD, u
+#define AD(u)	MOD_ALTGR | MOD_DEAD, u
+
+//One row per printable ASCII character starting with space,
+//one column per layout in the order of the LAYOUT_ ids in typing.h.
+//Usages are named after the key positions of a US keyboard
+#define LAYOUT_TABLE \
+	/*		   US		DE		FR		UK */ \
+	LAYOUT_KEY(' ',	K(0x2C),	K(0x2C),	K(0x2C),	K(0x2C)) \
+	LAYOUT_KEY('!',	S(0x1E),	S(0x1E),	K(0x38),	S(0x1E)) \
+	LAYOUT_KEY('"',	S(0x34),	S(0x1F),	K(0x20),	S(0x1F)) \
+	LAYOUT_KEY('#',	S(0x20),	K(0x32),	A(0x20),	K(0x32)) \
+	LAYOUT_KEY('$',	S(0x21),	S(0x21),	K(0x30),	S(0x21)) \
+	LAYOUT_KEY('%',	S(0x22),	S(0x22),	S(0x34),	S(0x22)) \
+	LAYOUT_KEY('&',	S(0x24),	S(0x23),	K(0x1E),	S(0x24)) \
+	LAYOUT_KEY('\'',	K(0x34),	S(0x32),	K(0x21),	K(0x34)) \
+	LAYOUT_KEY('(',	S(0x26),	S(0x25),	K(0x22),	S(0x26)) \
+	LAYOUT_KEY(')',	S(0x27),	S(0x26),	K(0x2D),	S(0x27)) \
+	LAYOUT_KEY('*',	S(0x25),	S(0x30),	K(0x32),	S(0x25)) \
+	LAYOUT_KEY('+',	S(0x2E),	K(0x30),	S(0x2E),	S(0x2E)) \
+	LAYOUT_KEY(',',	K(0x36),	K(0x36),	K(0x10),	K(0x36)) \
+	LAYOUT_KEY('-',	K(0x2D),	K(0x38),	K(0x23),	K(0x2D)) \
+	LAYOUT_KEY('.',	K(0x37),	K(0x37),	S(0x36),	K(0x37)) \
+	LAYOUT_KEY('/',	K(0x38),	S(0x24),	S(0x37),	K(0x38)) \
+	LAYOUT_KEY('0',	K(0x27),	K(0x27),	S(0x27),	K(0x27)) \
+	LAYOUT_KEY('1',	K(0x1E),	K(0x1E),	S(0x1E),	K(0x1E)) \
+	LAYOUT_KEY('2',	K(0x1F),	K(0x1F),	S(0x1F),	K(0x1F)) \
+	LAYOUT_KEY('3',	K(0x20),	K(0x20),	S(0x20),	K(0x20)) \
+	LAYOUT_KEY('4',	K(0x21),	K(0x21),	S(0x21),	K(0x21)) \
+	LAYOUT_KEY('5',	K(0x22),	K(0x22),	S(0x22),	K(0x22)) \
+	LAYOUT_KEY('6',	K(0x23),	K(0x23),	S(0x23),	K(0x23)) \
+	LAYOUT_KEY('7',	K(0x24),	K(0x24),	S(0x24),	K(0x24)) \
+	LAYOUT_KEY('8',	K(0x25),	K(0x25),	S(0x25),	K(0x25)) \
+	LAYOUT_KEY('9',	K(0x26),	K(0x26),	S(0x26),	K(0x26)) \
+	LAYOUT_KEY(':',	S(0x33),	S(0x37),	K(0x37),	S(0x33)) \
+	LAYOUT_KEY(';',	K(0x33),	S(0x36),	K(0x36),	K(0x33)) \
+	LAYOUT_KEY('<',	S(0x36),	K(0x64),	K(0x64),	S(0x36)) \
+	LAYOUT_KEY('=',	K(0x2E),	S(0x27),	K(0x2E),	K(0x2E)) \
+	LAYOUT_KEY('>',	S(0x37),	S(0x64),	S(0x64),	S(0x37)) \
+	LAYOUT_KEY('?',	S(0x38),	S(0x2D),	S(0x10),	S(0x38)) \
+	LAYOUT_KEY('@',	S(0x1F),	A(0x14),	A(0x27),	S(0x34)) \
+	LAYOUT_KEY('A',	S(0x04),	S(0x04),	S(0x14),	S(0x04)) \
+	LAYOUT_KEY('B',	S(0x05),	S(0x05),	S(0x05),	S(0x05)) \
+	LAYOUT_KEY('C',	S(0x06),	S(0x06),	S(0x06),	S(0x06)) \
+	LAYOUT_KEY('D',	S(0x07),	S(0x07),	S(0x07),	S(0x07)) \
+	LAYOUT_KEY('E',	S(0x08),	S(0x08),	S(0x08),	S(0x08)) \
+	LAYOUT_KEY('F',	S(0x09),	S(0x09),	S(0x09),	S(0x09)) \
+	LAYOUT_KEY('G',	S(0x0A),	S(0x0A),	S(0x0A),	S(0x0A)) \
+	LAYOUT_KEY('H',	S(0x0B),	S(0x0B),	S(0x0B),	S(0x0B)) \
+	LAYOUT_KEY('I',	S(0x0C),	S(0x0C),	S(0x0C),	S(0x0C)) \
+	LAYOUT_KEY('J',	S(0x0D),	S(0x0D),	S(0x0D),	S(0x0D)) \
+	LAYOUT_KEY('K',	S(0x0E),	S(0x0E),	S(0x0E),	S(0x0E)) \
+	LAYOUT_KEY('L',	S(0x0F),	S(0x0F),	S(0x0F),	S(0x0F)) \
+	LAYOUT_KEY('M',	S(0x10),	S(0x10),	S(0x33),	S(0x10)) \
+	LAYOUT_KEY('N',	S(0x11),	S(0x11),	S(0x11),	S(0x11)) \
+	LAYOUT_KEY('O',	S(0x12),	S(0x12),	S(0x12),	S(0x12)) \
+	LAYOUT_KEY('P',	S(0x13),	S(0x13),	S(0x13),	S(0x13)) \
+	LAYOUT_KEY('Q',	S(0x14),	S(0x14),	S(0x04),	S(0x14)) \
+	LAYOUT_KEY('R',	S(0x15),	S(0x15),	S(0x15),	S(0x15)) \
+	LAYOUT_KEY('S',	S(0x16),	S(0x16),	S(0x16),	S(0x16)) \
+	LAYOUT_KEY('T',	S(0x17),	S(0x17),	S(0x17),	S(0x17)) \
+	LAYOUT_KEY('U',	S(0x18),	S(0x18),	S(0x18),	S(0x18)) \
+	LAYOUT_KEY('V',	S(0x19),	S(0x19),	S(0x19),	S(0x19)) \
+	LAYOUT_KEY('W',	S(0x1A),	S(0x1A),	S(0x1D),	S(0x1A)) \
+	LAYOUT_KEY('X',	S(0x1B),	S(0x1B),	S(0x1B),	S(0x1B)) \
+	LAYOUT_KEY('Y',	S(0x1C),	S(0x1D),	S(0x1C),	S(0x1C)) \
+	LAYOUT_KEY('Z',	S(0x1D),	S(0x1C),	S(0x1A),	S(0x1D)) \
+	LAYOUT_KEY('[',	K(0x2F),	A(0x25),	A(0x22),	K(0x2F)) \
+	LAYOUT_KEY('\\',	K(0x31),	A(0x2D),	A(0x25),	K(0x64)) \
+	LAYOUT_KEY(']',	K(0x30),	A(0x26),	A(0x2D),	K(0x30)) \
+	LAYOUT_KEY('^',	S(0x23),	KD(0x35),	A(0x26),	S(0x23)) \
+	LAYOUT_KEY('_',	S(0x2D),	S(0x38),	K(0x25),	S(0x2D)) \
+	LAYOUT_KEY('`',	K(0x35),	SD(0x2E),	AD(0x24),	K(0x35)) \
+	LAYOUT_KEY('a',	K(0x04),	K(0x04),	K(0x14),	K(0x04)) \
+	LAYOUT_KEY('b',	K(0x05),	K(0x05),	K(0x05),	K(0x05)) \
+	LAYOUT_KEY('c',	K(0x06),	K(0x06),	K(0x06),	K(0x06)) \
+	LAYOUT_KEY('d',	K(0x07),	K(0x07),	K(0x07),	K(0x07)) \
+	LAYOUT_KEY('e',	K(0x08),	K(0x08),	K(0x08),	K(0x08)) \
+	LAYOUT_KEY('f',	K(0x09),	K(0x09),	K(0x09),	K(0x09)) \
+	LAYOUT_KEY('g',	K(0x0A),	K(0x0A),	K(0x0A),	K(0x0A)) \
+	LAYOUT_KEY('h',	K(0x0B),	K(0x0B),	K(0x0B),	K(0x0B)) \
+	LAYOUT_KEY('i',	K(0x0C),	K(0x0C),	K(0x0C),	K(0x0C)) \
+	LAYOUT_KEY('j',	K(0x0D),	K(0x0D),	K(0x0D),	K(0x0D)) \
+	LAYOUT_KEY('k',	K(0x0E),	K(0x0E),	K(0x0E),	K(0x0E)) \
+	LAYOUT_KEY('l',	K(0x0F),	K(0x0F),	K(0x0F),	K(0x0F)) \
+	LAYOUT_KEY('m',	K(0x10),	K(0x10),	K(0x33),	K(0x10)) \
+	LAYOUT_KEY('n',	K(0x11),	K(0x11),	K(0x11),	K(0x11)) \
+	LAYOUT_KEY('o',	K(0x12),	K(0x12),	K(0x12),	K(0x12)) \
+	LAYOUT_KEY('p',	K(0x13),	K(0x13),	K(0x13),	K(0x13)) \
+	LAYOUT_KEY('q',	K(0x14),	K(0x14),	K(0x04),	K(0x14)) \
+	LAYOUT_KEY('r',	K(0x15),	K(0x15),	K(0x15),	K(0x15)) \
+	LAYOUT_KEY('s',	K(0x16),	K(0x16),	K(0x16),	K(0x16)) \
+	LAYOUT_KEY('t',	K(0x17),	K(0x17),	K(0x17),	K(0x17)) \
+	LAYOUT_KEY('u',	K(0x18),	K(0x18),	K(0x18),	K(0x18)) \
+	LAYOUT_KEY('v',	K(0x19),	K(0x19),	K(0x19),	K(0x19)) \
+	LAYOUT_KEY('w',	K(0x1A),	K(0x1A),	K(0x1D),	K(0x1A)) \
+	LAYOUT_KEY('x',	K(0x1B),	K(0x1B),	K(0x1B),	K(0x1B)) \
+	LAYOUT_KEY('y',	K(0x1C),	K(0x1D),	K(0x1C),	K(0x1C)) \
+	LAYOUT_KEY('z',	K(0x1D),	K(0x1C),	K(0x1A),	K(0x1D)) \
+	LAYOUT_KEY('{',	S(0x2F),	A(0x24),	A(0x21),	S(0x2F)) \
+	LAYOUT_KEY('|',	S(0x31),	A(0x64),	A(0x23),	S(0x64)) \
+	LAYOUT_KEY('}',	S(0x30),	A(0x27),	A(0x2E),	S(0x30)) \
+	LAYOUT_KEY('~',	S(0x35),	A(0x30),	AD(0x1F),	S(0x32)) \
+
+#define LAYOUT_KEY(c, us, de, fr, uk)	{ {us}, {de}, {fr}, {uk} },
+
+const unsigned char layouts[][LAYOUT_COUNT][2] PROGMEM=
+{
+LAYOUT_TABLE
+};
+
+#undef LAYOUT_KEY
+
+#endif /* LAYOUTS_H_ */
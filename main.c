@@ -3,13 +3,15 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
-#include <avr/eeprom.h>
 #include <util/delay.h>
 #include "usbdrv/usbdrv.h"
 #include "lcd.h"
 #include "hid_descriptor.h"
 #include "keyboard.h"
 #include "storage.h"
+#include "backend.h"
+#include "typing.h"
+#include "timer.h"
 #include "config.h"
 
 //Button pins
@@ -21,19 +23,28 @@
 #define STATE_PRESSED 		0
 #define STATE_RELEASED 		1
 
-//States for USB message sending
-#define STATE_SEND 			2
-#define STATE_DONE 			3
-
 //Modes for the menu
 #define MODE_SEND			0
 #define MODE_ADD			1
 #define MODE_REMOVE			2
 #define MODE_CHANGE			3
-#define MODE_MENU			4
+#define MODE_LAYOUT			4
+#define MODE_CALIBRATE		5
+#define MODE_MENU			6
+#define MODE_INPUT			7	//Text typed in for input_target
+
+//Results of input_step()
+#define INPUT_PENDING		0
+#define INPUT_DONE			1
+#define INPUT_CANCELLED		2
 
 //Number of items in the menu
-#define MENU_LENGTH			4
+#define MENU_LENGTH			6
+
+//Longest time the host gets to take the calibration frames
+#define CALIBRATION_TIMEOUT	1000
+//How long a note stays on the display, in milliseconds
+#define NOTE_TIMEOUT		1000
 
 //Special interest characters for data input
 #define ESC					27
@@ -42,39 +53,49 @@
 // The buffer needs to accommodate a password + null terminator
 #define MSG_BUFFER_SIZE 	(PASSWORD_MAX_LENGTH + 1)
 
-#define MOD_SHIFT_LEFT (1<<1)
-
-typedef struct {
-	uint8_t modifier;
-	uint8_t reserved;
-	uint8_t keycode[6];
-} keyboard_report_t;
-
 // Store strings in program memory area
 char string_1[] PROGMEM = "SEND PASS";
 char string_2[] PROGMEM = "ADD PASS";
 char string_3[] PROGMEM = "REMOVE PASS";
 char string_4[] PROGMEM = "CHANGE PASS";
+char string_5[] PROGMEM = "KEYB LAYOUT";
+char string_6[] PROGMEM = "CALIBRATE";
 PGM_P menu_items[] PROGMEM =
 {
 	string_1,
 	string_2,
 	string_3,
 	string_4,
+	string_5,
+	string_6,
+};
+
+// Host keyboard layouts, in the order of the LAYOUT_ ids
+char layout_1[] PROGMEM = "US";
+char layout_2[] PROGMEM = "DE";
+char layout_3[] PROGMEM = "FR";
+char layout_4[] PROGMEM = "UK";
+PGM_P layout_names[] PROGMEM =
+{
+	layout_1,
+	layout_2,
+	layout_3,
+	layout_4,
 };
 
-static char** passwords;
 static uint8_t pass_no;
 
 static keyboard_report_t keyboard_report; // sent to PC
 static uchar idleRate; // repeat rate for the emulated keyboard
 
-static uchar messageState = STATE_DONE;
 static char stringBuffer[MSG_BUFFER_SIZE] = "";
-static uchar messagePtr = 0;
-static uchar messageCharNext = 1;
 
 static uint8_t mode;
+static uint8_t layout;
+
+//Characters typed in so far and the mode the text is for
+static uint8_t input_len;
+static uint8_t input_target;
 
 void init(void) {
 	PORTD |= _BV(SELECT);
@@ -84,7 +105,12 @@ void init(void) {
 	//LED used for debugging
 	DDRB = 1 << PB0; // PB0 as output
 
+	//After DDRB is set, an external EEPROM needs its pins
+	backend_init();
+
 	kb_init();
+	timer_init();
+	typing_init();
 	usbInit();
 	lcd_init(LCD_DISP_ON);
 	lcd_puts("..");
@@ -101,16 +127,17 @@ usbMsgLen_t usbFunctionSetup(uchar data[8]) {
 		case USBRQ_HID_GET_REPORT: // send "no keys pressed" if asked here
 			// wValue: ReportType (highbyte), ReportID (lowbyte)
 			usbMsgPtr = (void *) &keyboard_report; // we only have this one
-			keyboard_report.modifier = 0;
-			keyboard_report.keycode[0] = 0;
+			memset(&keyboard_report, 0, sizeof(keyboard_report));
 			return sizeof(keyboard_report);
 		case USBRQ_HID_SET_REPORT: // if wLength == 1, should be LED state
+			// the state itself arrives in usbFunctionWrite()
 			return (rq->wLength.word == 1) ? USB_NO_MSG : 0;
 		case USBRQ_HID_GET_IDLE: // send idle rate to PC as required by spec
 			usbMsgPtr = &idleRate;
 			return 1;
-		case USBRQ_HID_SET_IDLE: // save idle rate as required by spec
+		case USBRQ_HID_SET_IDLE: // the report pump resends on idle expiry
 			idleRate = rq->wValue.bytes[1];
+			typing_set_idle(idleRate);
 			return 0;
 		}
 	}
@@ -118,64 +145,14 @@ usbMsgLen_t usbFunctionSetup(uchar data[8]) {
 	return 0; // by default don't return any data
 }
 
-// The buildReport is called by main loop and it starts transmitting
-// characters when messageState == STATE_SEND. The message is stored
-// in messageBuffer and messagePtr tells the next character to send.
-// messagePtr needs to be reset each time  after populating messageBuffer
-uchar buildReport() {
-	uchar ch;
-
-	if (messageState == STATE_DONE || messagePtr >= sizeof(stringBuffer)
-			|| stringBuffer[messagePtr] == 0) {
-		keyboard_report.modifier = 0;
-		keyboard_report.keycode[0] = 0;
-		return STATE_DONE;
+//Receives the LED output report announced by SET_REPORT
+uchar usbFunctionWrite(uchar *data, uchar len) {
+	if (len == 1) {
+		typing_set_leds(data[0]);
+		//Caps Lock of the host shows on the PS/2 keyboard too
+		kb_set_leds((data[0] & LED_CAPS_LOCK) ? KB_LED_CAPS_LOCK : 0);
 	}
-
-	if (messageCharNext) { // send a keypress
-		ch = stringBuffer[messagePtr++];
-
-		// convert character to modifier + keycode
-		if (ch >= '0' && ch <= '9') {
-			keyboard_report.modifier = 0;
-			keyboard_report.keycode[0] = (ch == '0') ? 39 : 30 + (ch - '1');
-		} else if (ch >= 'a' && ch <= 'z') {
-			keyboard_report.modifier = 0;
-			keyboard_report.keycode[0] = 4 + (ch - 'a');
-		} else if (ch >= 'A' && ch <= 'Z') {
-			keyboard_report.modifier = MOD_SHIFT_LEFT;
-			keyboard_report.keycode[0] = 4 + (ch - 'A');
-		} else {
-			keyboard_report.modifier = 0;
-			keyboard_report.keycode[0] = 0;
-			switch (ch) {
-			case '.':
-				keyboard_report.keycode[0] = 0x37;
-				break;
-			case '_':
-				keyboard_report.modifier = MOD_SHIFT_LEFT;
-			case '-':
-				keyboard_report.keycode[0] = 0x2D;
-				break;
-			case ' ':
-				keyboard_report.keycode[0] = 0x2C;
-				break;
-			case '\t':
-				keyboard_report.keycode[0] = 0x2B;
-				break;
-			case '\n':
-				keyboard_report.keycode[0] = 0x28;
-				break;
-			}
-		}
-	} else { // key release before the next keypress!
-		keyboard_report.modifier = 0;
-		keyboard_report.keycode[0] = 0;
-	}
-
-	messageCharNext = !messageCharNext; // invert
-
-	return STATE_SEND;
+	return 1; // all data received
 }
 
 //LED used for debugging
@@ -249,30 +226,95 @@ uint8_t lcd_backspace(uint8_t cnt) {
 	return cnt - 1;
 }
 
-//Starts a data input session
-//Read characters from keyboard
-//Ends with ESC (cancelled) or ENTER (confirmed)
-uint8_t input_password() {
-	uint8_t cnt = 0;
-	uchar c;
+//Shows a short note, USB is kept alive meanwhile
+void lcd_note(const char* s) {
+	uint16_t start = timer_ms();
 
 	lcd_clrscr();
+	lcd_puts(s);
+	while ((uint16_t) (timer_ms() - start) < NOTE_TIMEOUT) {
+		typing_usb_poll();
+		typing_fill();
+	}
+}
 
-	kb_clear_buff();
-	c = kb_get_char();
-	while (c != '\r') {
-		if (c == ESC) {
-			return 0;
-		} else if (c == BACKSPACE) {
-			cnt = lcd_backspace(cnt);
-		} else if ((c < 0x80) && (cnt < LCD_LINES * LCD_DISP_LENGTH)) {
-			//If ASCII character is printable
+//Tells how many passwords of the previous firmware are still served from
+//the old vault, nothing is added or changed until they are converted
+void lcd_note_unconverted(void) {
+	uint8_t n = unconverted_passwords();
+
+	if (n != 0) {
+		utoa(n, stringBuffer, 10);
+		strcat(stringBuffer, " NOT CONVERTED");
+		lcd_note(stringBuffer);
+	}
+}
+
+//Displays a stored entry, the tokens of a macro are shown as markers
+void lcd_puts_entry(const char* s) {
+	uchar c;
+
+	while ((c = *s++) != 0) {
+		switch (c) {
+		case MACRO_KEY:
+			lcd_putc('*');
+			break;
+		case MACRO_CHORD:
+			lcd_putc('+');
+			break;
+		case MACRO_DELAY:
+			lcd_putc('.');
+			break;
+		case MACRO_PROFILE:
+			lcd_putc('>');
+			break;
+		default:
 			lcd_putc(c);
-			stringBuffer[cnt++] = c;
+			continue;
+		}
+		//Skip the operand
+		if (*s != 0) {
+			s++;
 		}
-		c = kb_get_char();
 	}
-	return cnt;
+}
+
+//Starts a data input session for MODE_ADD or MODE_CHANGE
+//The characters are taken by input_step() from the main loop
+void input_start(uint8_t target) {
+	lcd_clrscr();
+
+	kb_set_input(1);
+	//Held keys repeat sooner and faster while text is typed in
+	kb_set_typematic(KB_TYPEMATIC_FAST);
+	input_len = 0;
+	input_target = target;
+	mode = MODE_INPUT;
+}
+
+//Takes the next character from the keyboard, if there is one
+//The session ends with ESC (cancelled) or ENTER (confirmed), the text
+//is in stringBuffer then
+uint8_t input_step(void) {
+	uchar c;
+
+	if (!kb_try_get(&c)) {
+		return INPUT_PENDING;
+	}
+
+	if (c == '\r') {
+		stringBuffer[input_len] = '\0';
+		return (input_len > 0) ? INPUT_DONE : INPUT_CANCELLED;
+	} else if (c == ESC) {
+		return INPUT_CANCELLED;
+	} else if (c == BACKSPACE) {
+		input_len = lcd_backspace(input_len);
+	} else if ((c < 0x80) && (input_len < MSG_BUFFER_SIZE - 1)) {
+		//If ASCII character is printable
+		lcd_putc(c);
+		stringBuffer[input_len++] = c;
+	}
+	return INPUT_PENDING;
 }
 
 int main() {
@@ -280,7 +322,6 @@ int main() {
 	uint8_t menulen;
 	uint8_t button_pressed = UINT8_MAX - 1;
 	uint16_t i;
-	uint8_t pass_len;
 
 	//Since we are waiting indefinitely for input from keyboard,
 	//the watchdog is not applicable anymore
@@ -304,7 +345,15 @@ int main() {
 	//Enable this to reinitialize passwords/EEPROM
 	//eeprom_write_byte(0,0);
 
-	pass_no = read_passwords(&passwords);
+	pass_no = read_passwords();
+	lcd_note_unconverted();
+
+	layout = read_layout();
+	if (layout >= LAYOUT_COUNT) {
+		//Nothing stored yet
+		layout = LAYOUT_US;
+	}
+	typing_set_layout(layout);
 
 	index = 0;
 	mode = MODE_MENU;
@@ -313,25 +362,65 @@ int main() {
 	while (1) {
 		//wdt_reset();
 		// keep the watchdog happy
-		usbPoll();
+		typing_usb_poll();
 
 		//Only display stuff if a button was pressed
 		//(most likely something changed on the screen)
-		if (button_pressed != UINT8_MAX) {
+		//The text being typed in stays on the screen
+		if ((button_pressed != UINT8_MAX) && (mode != MODE_INPUT)) {
 			lcd_clrscr();
 			if (mode == MODE_MENU) {
 				strcpy_P(stringBuffer,
 						(PGM_P) pgm_read_word(&(menu_items[index])));
 				lcd_puts(stringBuffer);
+				if (index == MODE_CALIBRATE) {
+					//Show the host polling period the typing is paced by,
+					//the longest gap between frames of the last message and
+					//the characters and scancodes the PS/2 keyboard lost
+					lcd_gotoxy(0, 1);
+					lcd_puts("P");
+					lcd_puts(utoa(typing_poll_interval(), stringBuffer, 10));
+					lcd_puts(" G");
+					lcd_puts(utoa(typing_max_gap(), stringBuffer, 10));
+					lcd_puts(" L");
+					lcd_puts(utoa(kb_lost_chars(), stringBuffer, 10));
+					lcd_puts("/");
+					lcd_puts(utoa(kb_lost_scancodes(), stringBuffer, 10));
+				}
+			} else if (mode == MODE_LAYOUT) {
+				strcpy_P(stringBuffer,
+						(PGM_P) pgm_read_word(&(layout_names[index])));
+				lcd_puts(stringBuffer);
+				if (index == layout) {
+					//Mark the layout in use
+					lcd_puts(" *");
+				}
+			} else if (index >= pass_no) {
+				//No password to show or to pick
+				lcd_puts("EMPTY");
 			} else {
-				lcd_puts(passwords[index]);
+				//Only the entry on display is read from EEPROM
+				if (password_valid(index)) {
+					read_password(index, stringBuffer);
+					lcd_puts_entry(stringBuffer);
+				} else {
+					lcd_puts("DAMAGED");
+				}
 			}
 		}
 
 		button_pressed = poll_buttons();
+		if ((mode == MODE_INPUT) && (button_pressed != MENU)) {
+			//Only MENU leaves the text input, dropping the text
+			button_pressed = UINT8_MAX;
+		}
 
 		switch (button_pressed) {
 		case MENU:
+			if (mode == MODE_INPUT) {
+				kb_set_input(0);
+				kb_set_typematic(KB_TYPEMATIC_DEFAULT);
+			}
 			//Get back to the main menu
 			mode = MODE_MENU;
 			index = 0;
@@ -355,26 +444,24 @@ int main() {
 			if (mode == MODE_MENU) {
 				//We can add password directly from the MENU mode (main menu)
 				if (index == MODE_ADD) {
-
-					uint8_t pass_len;
-
-					pass_len = input_password();
-
-					if (pass_len > 0) {
-						stringBuffer[pass_len] = '\0';
-
-						passwords = realloc(passwords,
-								(pass_no + 1) * sizeof(char*));
-						passwords[pass_no] = malloc(pass_len * sizeof(char));
-						strcpy(passwords[pass_no], stringBuffer);
-						pass_no++;
-						menulen = pass_no;
-						write_passwords(pass_no, passwords);
+					input_start(MODE_ADD);
+				} else if (index == MODE_CALIBRATE) {
+					//Stay in the menu, the result is shown under the item
+					typing_calibrate();
+					i = timer_ms();
+					while (typing_busy()) {
+						typing_usb_poll();
+						if ((uint16_t) (timer_ms() - i) > CALIBRATION_TIMEOUT) {
+							//The host is not polling
+							typing_stop();
+						}
 					}
-					//Get back to the MENU mode (main menu)
-					mode = MODE_MENU;
-					menulen = MENU_LENGTH;
 					toggle_led(PB0);
+				} else if (index == MODE_LAYOUT) {
+					//Start from the layout in use
+					mode = MODE_LAYOUT;
+					index = layout;
+					menulen = LAYOUT_COUNT;
 				} else {
 					//Enter the corresponding mode
 					mode = index;
@@ -386,40 +473,44 @@ int main() {
 				if (index < menulen) {
 					switch (mode) {
 					case MODE_SEND:
-						//Send password to the PC
-						strcpy(stringBuffer, passwords[index]);
-						messagePtr = 0;
-						messageState = STATE_SEND;
+						//Send password to the PC, it is typed straight
+						//from EEPROM without a copy in RAM
+						if (password_valid(index)) {
+							pack_reader_t message;
+
+							password_open(index, &message);
+							typing_start(&message);
+						}
 						//Stay in the SEND mode displaying the same password
 						break;
 
 					case MODE_REMOVE:
-						//Remove password
-						free(passwords[index]);
-						for (i = index; i < pass_no - 1; i++) {
-							passwords[i] = passwords[i + 1];
+						//Remove password, the log needs room for a record
+						//telling it is gone
+						if (!remove_password(index)) {
+							lcd_note("VAULT FULL");
+							break;
 						}
 						pass_no--;
-						passwords = realloc(passwords, pass_no * sizeof(char*));
-						write_passwords(pass_no, passwords);
+						//The old vault is converted once the rest fits
+						lcd_note_unconverted();
 						//Stay in the REMOVE mode, but display the first password
 						index = 0;
 						menulen = pass_no;
 						break;
 
 					case MODE_CHANGE:
-						pass_len = input_password();
-
-						if (pass_len > 0) {
-							stringBuffer[pass_len] = '\0';
+						//The password at index is replaced once the new
+						//one is typed in
+						input_start(MODE_CHANGE);
+						break;
 
-							passwords[index] = realloc(passwords[index],
-									pass_len);
-							strcpy(passwords[index], stringBuffer);
-							write_passwords(pass_no, passwords);
-						}
-						//Stay in the CHANGE mode, but display the first password
-						index = 0;
+					case MODE_LAYOUT:
+						//Type the passwords for this layout from now on
+						layout = index;
+						typing_set_layout(layout);
+						write_layout(layout);
+						//Stay in the LAYOUT mode to show the new mark
 						toggle_led(PB0);
 						break;
 					}
@@ -428,10 +519,55 @@ int main() {
 			}
 			break;
 		}
-		// characters are sent when messageState == STATE_SEND
-		if (usbInterruptIsReady() && messageState == STATE_SEND) {
-			messageState = buildReport();
-			usbSetInterrupt((void *) &keyboard_report, sizeof(keyboard_report));
+		//One character typed in is handled on every pass, so USB and
+		//the buttons are serviced during the input
+		if (mode == MODE_INPUT) {
+			uint8_t status = input_step();
+
+			if (status != INPUT_PENDING) {
+				kb_set_input(0);
+				kb_set_typematic(KB_TYPEMATIC_DEFAULT);
+				if (status == INPUT_DONE) {
+					typing_compile(stringBuffer);
+					if (input_target == MODE_ADD) {
+						if (add_password(stringBuffer) != VAULT_FULL) {
+							pass_no++;
+						} else {
+							lcd_note("VAULT FULL");
+						}
+					} else if (!change_password(index, stringBuffer)) {
+						lcd_note("VAULT FULL");
+					}
+				}
+
+				if (input_target == MODE_ADD) {
+					//Get back to the MENU mode (main menu)
+					mode = MODE_MENU;
+					menulen = MENU_LENGTH;
+				} else {
+					//Stay in the CHANGE mode, but display the first password
+					mode = MODE_CHANGE;
+					index = 0;
+				}
+				toggle_led(PB0);
+				//Show the mode again
+				button_pressed = UINT8_MAX - 1;
+			}
+		}
+
+		// frames are encoded when a password is selected and handed
+		// to the driver by the report pump, here they are only topped up
+		typing_fill();
+		//Keeps track of shift while no text is typed in
+		kb_poll();
+		if (!typing_busy()) {
+			//Old versions of the passwords are dropped meanwhile
+			storage_poll();
+			if (storage_failed()) {
+				lcd_note("EEPROM ERROR");
+				//Show the mode again
+				button_pressed = UINT8_MAX - 1;
+			}
 		}
 	}
 
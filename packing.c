@@ -0,0 +1,167 @@
+#include "config.h"
+#include "packing.h"
+#include "eeprom_queue.h"
+
+//A packed password is a stream of 6-bit symbols, the first one in the
+//high bits of the first byte. Letters and digits take a symbol, any
+//other byte follows the escape symbol as 8 bits of its own. The stream
+//ends with the bytes, the bits after the last symbol are 0 and read as
+//symbol 0.
+//A password of digits alone is a stream of 4-bit digits instead, an odd
+//one is followed by DIGIT_END.
+#define SYMBOL_BITS		6
+#define SYMBOL_END		0
+#define SYMBOL_ESCAPE	63
+#define SYMBOL_LOWER	1
+#define SYMBOL_UPPER	27
+#define SYMBOL_DIGIT	53
+#define DIGIT_BITS		4
+#define DIGIT_END		0x0F
+
+static uint8_t symbol(uint8_t ch) {
+	if (ch >= 'a' && ch <= 'z') {
+		return SYMBOL_LOWER + ch - 'a';
+	}
+	if (ch >= 'A' && ch <= 'Z') {
+		return SYMBOL_UPPER + ch - 'A';
+	}
+	if (ch >= '0' && ch <= '9') {
+		return SYMBOL_DIGIT + ch - '0';
+	}
+	return SYMBOL_ESCAPE;
+}
+
+//Packs the null terminated s into out, which has room for as many bytes
+//as s has characters.
+//Returns the length byte of the packed password, 0 if packing saves
+//nothing
+uint8_t pack_string(const char* s, uint8_t* out) {
+	uint8_t limit = 0;
+	uint8_t digits = 1;
+	uint8_t n = 0;
+	uint8_t count = 0;
+	uint16_t bits = 0;
+	uint8_t ch, sym;
+
+	for (; s[limit] != 0; limit++) {
+		if ((s[limit] < '0') || (s[limit] > '9')) {
+			digits = 0;
+		}
+	}
+
+	if (digits) {
+		for (; *s != 0; s += 2) {
+			ch = (*s - '0') << DIGIT_BITS;
+			ch |= (s[1] != 0) ? s[1] - '0' : DIGIT_END;
+			out[n++] = ch;
+			if (s[1] == 0) {
+				break;
+			}
+		}
+		return (n < limit) ? n | PACKED | PACKED_DIGITS : 0;
+	}
+
+	while ((ch = *s++) != 0) {
+		sym = symbol(ch);
+		bits = (bits << SYMBOL_BITS) | sym;
+		count += SYMBOL_BITS;
+		if (sym == SYMBOL_ESCAPE) {
+			if (count >= 8) {
+				//Keep room in bits for the escaped byte
+				count -= 8;
+				if (n + 1 >= limit) {
+					return 0;
+				}
+				out[n++] = bits >> count;
+			}
+			bits = (bits << 8) | ch;
+			count += 8;
+		}
+		while (count >= 8) {
+			count -= 8;
+			if (n + 1 >= limit) {
+				return 0;
+			}
+			out[n++] = bits >> count;
+		}
+	}
+
+	if (count != 0) {
+		if (n + 1 >= limit) {
+			return 0;
+		}
+		out[n++] = bits << (8 - count);
+	}
+	return n | PACKED;
+}
+
+//Starts reading the password at addr whose length byte is len
+void pack_open(pack_reader_t* r, uint16_t addr, uint8_t len) {
+	r->addr = addr;
+	r->left = len;
+	r->packed = len & PACKED;
+	if (r->packed) {
+		r->left = packed_length(len);
+		r->packed |= len & PACKED_DIGITS;
+	}
+	r->count = 0;
+	r->bits = 0;
+}
+
+//Takes the next n bits of a packed password, n is 8 at most.
+//Past the end of the password they are 0
+static uint8_t take(pack_reader_t* r, uint8_t n) {
+	if (r->count < n) {
+		r->bits <<= 8;
+		if (r->left != 0) {
+			r->bits |= ee_read_byte(r->addr++);
+			r->left--;
+		}
+		r->count += 8;
+	}
+	r->count -= n;
+	return (r->bits >> r->count) & ((1 << n) - 1);
+}
+
+//Returns the next character of the password, 0 at its end and after it
+uint8_t pack_getc(pack_reader_t* r) {
+	uint8_t sym;
+
+	if (!r->packed) {
+		if (r->left == 0) {
+			return 0;
+		}
+		r->left--;
+		return ee_read_byte(r->addr++);
+	}
+
+	if (r->packed & PACKED_DIGITS) {
+		if ((r->left == 0) && (r->count < DIGIT_BITS)) {
+			return 0;
+		}
+		sym = take(r, DIGIT_BITS);
+		if (sym == DIGIT_END) {
+			r->left = 0;
+			r->count = 0;
+			return 0;
+		}
+		return '0' + sym;
+	}
+
+	sym = take(r, SYMBOL_BITS);
+	if (sym == SYMBOL_END) {
+		//Nothing more is read after the end
+		r->left = 0;
+		return 0;
+	}
+	if (sym == SYMBOL_ESCAPE) {
+		return take(r, 8);
+	}
+	if (sym >= SYMBOL_DIGIT) {
+		return '0' + sym - SYMBOL_DIGIT;
+	}
+	if (sym >= SYMBOL_UPPER) {
+		return 'A' + sym - SYMBOL_UPPER;
+	}
+	return 'a' + sym - SYMBOL_LOWER;
+}
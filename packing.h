@@ -0,0 +1,28 @@
+#ifndef PACKING_H_
+#define PACKING_H_
+
+#include <stdint.h>
+
+//Set in the length byte of a packed password, the rest of the byte is
+//the number of bytes it takes in EEPROM. Next to it PACKED_DIGITS marks
+//a password of digits alone, packed two digits a byte.
+#define PACKED			0x80
+#define PACKED_DIGITS	0x40
+#define packed_length(len)	((len) & ~(PACKED | PACKED_DIGITS))
+
+//Reads a stored password a character at a time
+typedef struct {
+	uint16_t addr;		//Next EEPROM byte
+	uint8_t left;		//Bytes not read yet
+	uint8_t packed;		//PACKED and PACKED_DIGITS of the length byte
+	uint8_t count;		//Bits not taken yet from the low end of bits
+	uint16_t bits;
+} pack_reader_t;
+
+uint8_t pack_string(const char* s, uint8_t* out);
+
+void pack_open(pack_reader_t* r, uint16_t addr, uint8_t len);
+
+uint8_t pack_getc(pack_reader_t* r);
+
+#endif /* PACKING_H_ */
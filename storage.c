@@ -1,84 +1,1163 @@
-#include <stdlib.h>
-#include <avr/eeprom.h>
+#include <string.h>
 #include "config.h"
 #include "storage.h"
+#include "eeprom_queue.h"
+#include "crc16.h"
+#include "packing.h"
 
-//Writes a null terminated string to EEPROM character by character
-uint16_t eeprom_write_string(char* s, uint8_t* addr) {
-	uint16_t cnt = 0;
-	do {
-		eeprom_busy_wait();
-		eeprom_update_byte(addr++, *s);
-		cnt++;
-	} while (*s++ != '\0');
-	return cnt;
-}
-
-//Reads a null terminated string from EEPROM
-uint16_t eeprom_read_string(char* s, uint8_t* addr) {
-	uint16_t cnt = 0;
-	do {
-		eeprom_busy_wait();
-		*s = eeprom_read_byte(addr++);
-		cnt++;
-	} while (*s++ != '\0');
-	return cnt;
-}
-
-uint8_t read_passwords(char*** passwords) {
-	uint16_t addr = 0;
-	uint16_t i;
+//The first byte of the EEPROM tells the format of the vault. By default
+//it is a circular log of records. A change never rewrites a record, it
+//appends a new version of it, so the writes go round the whole EEPROM
+//instead of hammering its first bytes.
+//
+//[format][header slots][log ...................................][layout]
+//
+//A record is [id][length][crc][password], a removed password gets a
+//record of length 0. The top bits of the length mark a packed password.
+//Records are numbered in the order they are written. The CRC-16 covers
+//the number, which is not stored, and the bytes of the record, so one
+//left from an earlier round of the log fails it. A record failing it is
+//left out at boot and the version before it stays in use. The oldest
+//record is the tail of the log, the byte after the newest record is an
+//end marker. Old versions are dropped at the tail, a live one found
+//there is carried to the end.
+#define FORMAT_ADDRESS		0
+#define VAULT_FORMAT_LOG	0xA5
+
+//The tail and the number of its record are kept in one of several
+//header slots [sequence][tail][number][crc], each save goes to the slot
+//after the newest one
+#define HEADER_ADDRESS		1
+#define HEADER_SLOTS		4
+#define HEADER_SIZE			6
+//Bytes in front of the CRC
+#define HEADER_FIELDS		4
+
+#define LOG_START			(HEADER_ADDRESS + HEADER_SLOTS * HEADER_SIZE)
+#define LOG_END				EEPROM_LAYOUT_ADDRESS
+#define LOG_SIZE			(LOG_END - LOG_START)
+
+#define RECORD_HEADER		4
+//Bytes in front of the CRC
+#define RECORD_FIELDS		2
+#define RECORD_MAX			(RECORD_HEADER + PASSWORD_MAX_LENGTH)
+//Values of the id byte above the ids mark the end of the log and a jump
+//back to its start
+#define LOG_WRAP			0xFE
+#define LOG_END_MARK		0xFF
+
+//A new password leaves room on top of the reserve for a record removing
+//a password, split over the end and the start of the EEPROM at worst
+#define REMOVE_RESERVE		(2 * (RECORD_HEADER + 1))
+//Start compacting in the background below this much free room
+#define COMPACT_THRESHOLD	(2 * (RECORD_MAX + 1) + REMOVE_RESERVE)
+
+//Previous format: [hash][count] and [length][password\0] records
+#define LEGACY_RECORDS		2
+#define LEGACY_DELETED		0x80
+//Set while a converted log waits for its header slots, a header at
+//RESCUE_ADDRESS holds where the log starts meanwhile. A byte torn while
+//it is programmed keeps the bits set in both values, and any other bit
+//may be set. Bit 3 keeps one torn from EEPROM_HASH apart from the other
+//formats, bit 0 one torn on the way to VAULT_FORMAT_LOG.
+#define VAULT_FORMAT_CONVERTING	0xA9
+//Set while the log is written behind the old records. A byte torn on the
+//way from EEPROM_HASH keeps its bits, the old count keeps it apart from
+//an erased chip.
+#define VAULT_FORMAT_STARTED	0xAB
+#define legacy_started(f)	((((f) & EEPROM_HASH) == EEPROM_HASH) \
+		&& (read_byte(1) != 0xFF))
+#define RESCUE_ADDRESS		(LOG_END - HEADER_SIZE)
+
+//Every password takes at least a record with one character, that
+//bounds the number of ids the log can hold. A large memory is held to
+//what the index in RAM and a byte wide id allow
+#define LOG_IDS				((LOG_SIZE - 2 * (RECORD_HEADER + 2) - REMOVE_RESERVE) \
+		/ (RECORD_HEADER + 1))
+#define VAULT_IDS			((LOG_IDS < VAULT_MAX_IDS) ? LOG_IDS : VAULT_MAX_IDS)
+#define VAULT_MAX_IDS		64
+//A free id holds the next free one in its index entry
+#define ID_FREE				0x8000
+#define id_live(id)			(!(record_addr[id] & ID_FREE))
+
+//Log address of every id
+static uint16_t record_addr[VAULT_IDS];
+static uint8_t free_id;
+//Room taken by the newest versions, the rest of the log can be dropped
+static uint16_t live_bytes;
+
+static uint16_t head;
+static uint16_t tail;
+//The tail the header holds, the room up to the tail in RAM is not
+//written before the header catches up
+static uint16_t saved_tail;
+static uint8_t header_slot;
+static uint8_t header_sequence;
+//Numbers of the record at the tail and of the next one written
+static uint8_t tail_sequence;
+static uint8_t sequence;
+
+//The writes are programmed in the background in the order they are
+//made, a record is still linked to the log by its last written byte
+#define read_byte(addr)			ee_read_byte(addr)
+#define write_byte(addr, value)	ee_write_byte(addr, value)
+
+//Adds n bytes of EEPROM to a checksum
+static uint16_t crc_bytes(uint16_t crc, uint16_t addr, uint8_t n) {
+	while (n-- > 0) {
+		crc = crc16_update(crc, read_byte(addr++));
+	}
+	return crc;
+}
+
+static uint16_t read_crc(uint16_t addr) {
+	return read_byte(addr) | (read_byte(addr + 1) << 8);
+}
+
+static void write_crc(uint16_t addr, uint16_t crc) {
+	write_byte(addr, crc & 0xFF);
+	write_byte(addr + 1, crc >> 8);
+}
+
+//Writes a header [sequence][tail][number][crc] at addr
+static void write_header_at(uint16_t addr, uint8_t s, uint16_t t,
+		uint8_t number) {
+	uint16_t crc = CRC16_INIT;
+
+	crc = crc16_update(crc, s);
+	crc = crc16_update(crc, t & 0xFF);
+	crc = crc16_update(crc, t >> 8);
+	crc = crc16_update(crc, number);
+
+	//The sequence number goes last, until then the previous slot holds
+	write_byte(addr + 1, t & 0xFF);
+	write_byte(addr + 2, t >> 8);
+	write_byte(addr + 3, number);
+	write_crc(addr + HEADER_FIELDS, crc);
+	write_byte(addr, s);
+}
+
+static void write_header(uint8_t slot, uint8_t s, uint16_t t,
+		uint8_t number) {
+	write_header_at(HEADER_ADDRESS + slot * HEADER_SIZE, s, t, number);
+}
+
+static uint8_t header_valid(uint16_t addr) {
+	return crc_bytes(CRC16_INIT, addr, HEADER_FIELDS)
+			== read_crc(addr + HEADER_FIELDS);
+}
+
+static void save_header(void) {
+	header_slot = (header_slot + 1) % HEADER_SLOTS;
+	header_sequence++;
+	write_header(header_slot, header_sequence, tail, tail_sequence);
+	saved_tail = tail;
+}
+
+//Finds the newest of the header slots passing their CRC, the sequence
+//numbers of the slots are at most HEADER_SLOTS apart
+static void load_header(void) {
+	uint16_t addr;
+	uint8_t found = 0;
+	uint8_t s;
+	uint8_t i;
+
+	for (i = 0; i < HEADER_SLOTS; i++) {
+		addr = HEADER_ADDRESS + i * HEADER_SIZE;
+		s = read_byte(addr);
+		if (header_valid(addr)
+				&& (!found || ((int8_t) (s - header_sequence) > 0))) {
+			found = 1;
+			header_slot = i;
+			header_sequence = s;
+			tail = read_byte(addr + 1) | (read_byte(addr + 2) << 8);
+			tail_sequence = read_byte(addr + 3);
+		}
+	}
+
+	saved_tail = tail;
+	if (!found || (tail < LOG_START) || (tail >= LOG_END)) {
+		tail = LOG_START;
+		tail_sequence = 0;
+		write_byte(tail, LOG_END_MARK);
+		save_header();
+	}
+}
+
+//Room left between the end of the log and its tail, when the end of the
+//log is at 'from'
+static uint16_t log_free(uint16_t from) {
+	if (tail > from) {
+		return tail - from;
+	}
+	return (LOG_END - from) + (tail - LOG_START);
+}
+
+//Returns where a record of n bytes goes, 0 when it does not fit. The
+//record is followed by the end marker and never runs over the end of
+//the EEPROM so it can be typed straight from it.
+static uint16_t log_place(uint8_t n) {
+	if (tail > head) {
+		return (head + n < tail) ? head : 0;
+	}
+	if (head + n < LOG_END) {
+		return head;
+	}
+	return (LOG_START + n < tail) ? LOG_START : 0;
+}
+
+//Writes a record at the end of the log. The byte linking it to the log,
+//its id or a jump from the old end, is written last so a reset in
+//between loses only this record.
+static uint16_t log_append(uint8_t id, uint8_t len, const uint8_t* data,
+		uint16_t src) {
+	uint8_t n = RECORD_HEADER + packed_length(len);
+	uint16_t at = log_place(n);
+	uint16_t crc = CRC16_INIT;
+	uint8_t value;
+	uint8_t i;
+
+	if (at == 0) {
+		return 0;
+	}
+
+	if ((saved_tail != tail)
+			&& ((at == LOG_START) || ((uint16_t) (saved_tail - at) <= n))) {
+		//The record goes over room freed since the header was saved
+		save_header();
+	}
+
+#define record_byte(i)	((data != NULL) ? data[i] : read_byte(src + (i)))
+
+	crc = crc16_update(crc, sequence);
+	crc = crc16_update(crc, id);
+	crc = crc16_update(crc, len);
+	for (i = 0; i < packed_length(len); i++) {
+		crc = crc16_update(crc, record_byte(i));
+	}
+
+	//Everything up to the end marker is written in address order, an
+	//external EEPROM programs it in as few pages as it spans
+	write_byte(at + 1, len);
+	write_crc(at + RECORD_FIELDS, crc);
+	for (i = 0; i < packed_length(len); i++) {
+		value = record_byte(i);
+		write_byte(at + RECORD_HEADER + i, value);
+	}
+	write_byte(at + n, LOG_END_MARK);
+	write_byte(at, id);
+	if (at != head) {
+		write_byte(head, LOG_WRAP);
+	}
+
+	sequence++;
+	head = at + n;
+
+	return at;
+
+#undef record_byte
+}
+
+//Drops the oldest record, a live one is carried to the end of the log
+static uint8_t compact_step(void) {
+	uint8_t id;
 	uint8_t len;
-	uint8_t hash;
+	uint16_t at;
 
-	//Read hash value
-	eeprom_busy_wait();
-	hash = eeprom_read_byte((uint8_t*) (addr++));
+	if (tail == head) {
+		//Nothing left to drop
+		return 0;
+	}
+	if (read_byte(tail) == LOG_WRAP) {
+		tail = LOG_START;
+		return 1;
+	}
 
-	if (hash != EEPROM_HASH) {
-		//EEPROM is corrupt
-		//Consider no passwords stored
+	id = read_byte(tail);
+	len = read_byte(tail + 1);
+	if ((len != 0) && (record_addr[id] == tail)) {
+		at = log_append(id, len, NULL, tail + RECORD_HEADER);
+		if (at == 0) {
+			return 0;
+		}
+		record_addr[id] = at;
+	}
+	tail += RECORD_HEADER + packed_length(len);
+	tail_sequence++;
+
+	return 1;
+}
+
+//Appends a record leaving 'keep' bytes free, compacts first if needed
+static uint16_t store(uint8_t id, uint8_t len, const uint8_t* data,
+		uint16_t keep) {
+	uint8_t n = RECORD_HEADER + packed_length(len);
+	uint16_t at;
+	uint16_t steps;
+
+	for (steps = 0; steps < LOG_SIZE / RECORD_HEADER; steps++) {
+		at = log_place(n);
+		if ((at != 0) && (log_free(at + n) >= keep)) {
+			return log_append(id, len, data, 0);
+		}
+		if ((LOG_SIZE - log_free(head) <= live_bytes) || !compact_step()) {
+			//Only the newest versions are left
+			break;
+		}
+	}
+
+	return 0;
+}
+
+//Points an id at its newest record, 0 frees the id
+static void set_record(uint8_t id, uint16_t addr) {
+	if (id_live(id)) {
+		live_bytes -= RECORD_HEADER
+				+ packed_length(read_byte(record_addr[id] + 1));
+	}
+	if (addr != 0) {
+		live_bytes += RECORD_HEADER + packed_length(read_byte(addr + 1));
+		record_addr[id] = addr;
+	} else {
+		record_addr[id] = ID_FREE | free_id;
+		free_id = id;
+	}
+}
+
+//Walks the log from its tail and notes the newest version of every
+//record, the end is the end marker or a record failing its CRC
+static void log_scan(void) {
+	uint16_t addr = tail;
+	uint16_t walked = 0;
+	uint16_t jump = 0;
+	uint8_t damaged = 0;
+	uint8_t id;
+	uint8_t len;
+
+	for (id = 0; id < VAULT_IDS; id++) {
+		record_addr[id] = ID_FREE;
+	}
+
+	sequence = tail_sequence;
+	while (walked < LOG_SIZE) {
+		id = read_byte(addr);
+		if (id == LOG_WRAP) {
+			//An id torn while it was written can read as a jump, the log
+			//goes on only if a record follows at the start
+			jump = addr;
+			walked += LOG_END - addr;
+			addr = LOG_START;
+			continue;
+		}
+		if (id == LOG_END_MARK) {
+			break;
+		}
+
+		len = packed_length(read_byte(addr + 1));
+		if ((id >= VAULT_IDS) || (len > PASSWORD_MAX_LENGTH)
+				|| (addr + RECORD_HEADER + len >= LOG_END)) {
+			break;
+		}
+
+		if (crc_bytes(crc_bytes(crc16_update(CRC16_INIT, sequence), addr,
+				RECORD_FIELDS), addr + RECORD_HEADER, len)
+				== read_crc(addr + RECORD_FIELDS)) {
+			record_addr[id] = (len != 0) ? addr : ID_FREE;
+			damaged = 0;
+		} else if (damaged || (jump != 0)) {
+			//What follows a jump or a damaged record is not a record of
+			//this round of the log
+			break;
+		} else {
+			//A damaged record is skipped when the next one fits its
+			//length and number
+			damaged = 1;
+		}
+		sequence++;
+		jump = 0;
+		addr += RECORD_HEADER + len;
+		walked += RECORD_HEADER + len;
+	}
+
+	//Whatever follows the last record is not part of the log
+	head = (jump != 0) ? jump : addr;
+	write_byte(head, LOG_END_MARK);
+
+	//Chain the free ids, the lowest one first
+	free_id = VAULT_IDS;
+	live_bytes = 0;
+	for (id = VAULT_IDS; id-- > 0;) {
+		if (id_live(id)) {
+			live_bytes += RECORD_HEADER
+					+ packed_length(read_byte(record_addr[id] + 1));
+		} else {
+			record_addr[id] = ID_FREE | free_id;
+			free_id = id;
+		}
+	}
+}
+
+//Points every header slot at an empty log starting at 'start'
+static void log_headers(uint16_t start) {
+	uint8_t i;
+
+	//Consecutive sequence numbers, the last slot is the newest
+	for (i = 0; i < HEADER_SLOTS; i++) {
+		write_header(i, i, start, 0);
+	}
+}
+
+//Starts an empty log at 'start'
+static void log_format(uint16_t start) {
+	log_headers(start);
+	write_byte(start, LOG_END_MARK);
+	write_byte(FORMAT_ADDRESS, VAULT_FORMAT_LOG);
+}
+
+//Puts the bytes to store for s in data and returns their length byte
+static uint8_t encode(const char* s, uint8_t* data) {
+	uint8_t len;
+
+#if VAULT_PACKING
+	len = pack_string(s, data);
+	if (len != 0) {
+		return len;
+	}
+#endif
+	//The terminator is not stored but for an empty password, a length
+	//of 0 is a removal
+	len = strlen(s);
+	if (len == 0) {
+		len = 1;
+	}
+	memcpy(data, s, len);
+	return len;
+}
+
+//Reads the password of a record of the previous format at addr, which
+//takes nr bytes, and puts the bytes to store for it in data.
+//Returns their length byte
+static uint8_t legacy_read(uint16_t addr, uint8_t nr, uint8_t* data) {
+	char s[PASSWORD_MAX_LENGTH + 1];
+	uint8_t i;
+
+	//Whatever the EEPROM holds, the copy is terminated
+	for (i = 0; (i < nr) && (i < sizeof(s)); i++) {
+		s[i] = read_byte(addr + i);
+	}
+	s[i - 1] = '\0';
+
+	return encode(s, data);
+}
+
+//Records of the previous format are only looked for in front of this
+static uint16_t legacy_limit = STORAGE_SIZE;
+
+//Walks the records of the previous format. A record ends at the
+//terminator of its password, as the first firmware read it, so a length
+//byte torn while it was marked removed does not throw the walk off. A
+//live password has its length in it, a removed one has the top bit set.
+//Returns the address of the length byte of the live password 'index',
+//past the last password the address after the records. 'live' gets the
+//number of passwords walked over.
+static uint16_t legacy_walk(uint8_t index, uint8_t* live) {
+	uint16_t addr = LEGACY_RECORDS;
+	uint8_t records = read_byte(1);
+	uint16_t len;
+	uint8_t nr;
+
+	*live = 0;
+	for (; (records > 0) && (addr < legacy_limit); records--) {
+		for (len = 1; (addr + len < STORAGE_SIZE)
+				&& (read_byte(addr + len) != '\0'); len++) {
+		}
+		if (addr + len >= STORAGE_SIZE) {
+			//Whatever follows is not a record
+			break;
+		}
+		nr = read_byte(addr);
+		if (nr == len) {
+			if (*live == index) {
+				break;
+			}
+			(*live)++;
+		}
+		addr += 1 + len;
+	}
+
+	return addr;
+}
+
+//Returns where the log of the passwords of the previous format starts,
+//right behind the last of them. 'live' gets the number of passwords and
+//'room' the bytes their records take in the log
+static uint16_t legacy_plan(uint8_t* live, uint16_t* room) {
+	uint8_t data[PASSWORD_MAX_LENGTH + 1];
+	uint16_t start = LOG_START;
+	uint16_t addr;
+	uint8_t nr;
+	uint8_t i;
+
+	legacy_walk(UINT8_MAX, live);
+	*room = 0;
+	for (i = 0; (i < *live) && (*live <= VAULT_IDS); i++) {
+		addr = legacy_walk(i, &nr);
+		nr = read_byte(addr);
+		*room += RECORD_HEADER + packed_length(legacy_read(addr + 1, nr, data));
+		if (addr + 1 + nr > start) {
+			start = addr + 1 + nr;
+		}
+	}
+
+	return start;
+}
+
+//Converts the vault of the previous format when the log has room for all
+//its passwords. A reset at any point leaves the old vault or the new one,
+//the conversion is started over from where it can be:
+// - The format byte turns to VAULT_FORMAT_STARTED. From then on only the
+//   old records in front of the rescue header are read.
+// - The rescue header notes the number of passwords and where the log
+//   starts, right behind the last of them. Removed records past them are
+//   reused. Once the header passes its CRC only the old records in front
+//   of the log are read.
+// - The passwords are appended to the log, no byte they are read from
+//   is written. Started over, the conversion writes the same bytes again.
+// - The format byte turns to VAULT_FORMAT_CONVERTING.
+// - The header slots go over the old count and first records, then the
+//   format byte turns to VAULT_FORMAT_LOG. Started over, the slots are
+//   written again from the rescue header.
+//A password is never dropped. When they do not all fit between the old
+//records and the rescue header nothing is written, the old vault is kept
+//in use.
+//Returns the number of passwords left in the old vault, 0 once converted
+static uint8_t legacy_convert(void) {
+	uint8_t data[PASSWORD_MAX_LENGTH + 1];
+	uint8_t f = read_byte(FORMAT_ADDRESS);
+	uint8_t redo = (f != VAULT_FORMAT_CONVERTING);
+	uint16_t addr;
+	uint16_t start;
+	uint16_t room;
+	uint8_t live;
+	uint8_t ids;
+	uint8_t len;
+
+	legacy_limit = STORAGE_SIZE;
+	if (f != EEPROM_HASH) {
+		legacy_limit = RESCUE_ADDRESS;
+		if (header_valid(RESCUE_ADDRESS)) {
+			//The log is written again while the old records in front of
+			//it lead to the header. Otherwise the header slots went over
+			//them already
+			legacy_limit = read_byte(RESCUE_ADDRESS + 1)
+					| (read_byte(RESCUE_ADDRESS + 2) << 8);
+			redo = redo && (legacy_plan(&live, &room) == legacy_limit)
+					&& (live == read_byte(RESCUE_ADDRESS));
+		}
+	}
+
+	if (redo) {
+		start = legacy_plan(&live, &room);
+		if ((live > VAULT_IDS) || (start + room >= RESCUE_ADDRESS)) {
+			return live;
+		}
+		if (f == EEPROM_HASH) {
+			write_byte(FORMAT_ADDRESS, VAULT_FORMAT_STARTED);
+		}
+		write_header_at(RESCUE_ADDRESS, live, start, 0);
+		legacy_limit = start;
+
+		head = start;
+		tail = start;
+		saved_tail = start;
+		sequence = 0;
+		write_byte(start, LOG_END_MARK);
+
+		for (ids = 0; ids < live; ids++) {
+			addr = legacy_walk(ids, &len);
+			len = legacy_read(addr + 1, read_byte(addr), data);
+			log_append(ids, len, data, 0);
+		}
+
+		write_byte(FORMAT_ADDRESS, VAULT_FORMAT_CONVERTING);
+	}
+
+	start = read_byte(RESCUE_ADDRESS + 1)
+			| (read_byte(RESCUE_ADDRESS + 2) << 8);
+	if (!header_valid(RESCUE_ADDRESS) || (start < LOG_START)
+			|| (start >= LOG_END)) {
+		//The log can not be found, start an empty one
+		log_format(LOG_START);
 		return 0;
 	}
+	log_headers(start);
+	write_byte(FORMAT_ADDRESS, VAULT_FORMAT_LOG);
+	return 0;
+}
+
+//Passwords of the old vault kept in use
+static uint8_t unconverted;
 
-	//Read total number of passwords
-	eeprom_busy_wait();
-	len = eeprom_read_byte((uint8_t*) (addr++));
+//Deletes a password of the old vault and converts it if the rest fits
+//now. Setting the top bit of the length is safe from a reset, a torn
+//byte keeps the bits set in both values.
+static void legacy_remove(uint8_t index) {
+	uint8_t live;
+	uint16_t addr = legacy_walk(index, &live);
+
+	write_byte(addr, read_byte(addr) | LEGACY_DELETED);
+	unconverted = legacy_convert();
+}
 
-	*passwords = malloc(len * sizeof(char*));
+//Returns the id of a password, passwords are listed by their id
+static uint8_t entry_id(uint8_t index) {
+	uint8_t id;
+
+	for (id = 0; id < VAULT_IDS; id++) {
+		if (id_live(id)) {
+			if (index == 0) {
+				break;
+			}
+			index--;
+		}
+	}
+
+	return id;
+}
 
-	for (i = 0; i < len; i++) {
-		//Read number of characters in the password
-		eeprom_busy_wait();
-		uint8_t nr = eeprom_read_byte((uint8_t*) (addr++));
+//Room kept free so the tail can always be carried to the end. The
+//largest live record or a new one of n bytes is carried, split over the
+//end and the start of the EEPROM at worst
+static uint16_t log_reserve(uint8_t n) {
+	uint8_t id;
+	uint8_t r;
 
-		//Read the password itself
-		(*passwords)[i] = malloc(nr * sizeof(char));
-		nr = eeprom_read_string((*passwords)[i], (uint8_t*) addr);
-		addr += nr;
+	for (id = 0; id < VAULT_IDS; id++) {
+		if (id_live(id)) {
+			r = RECORD_HEADER + packed_length(read_byte(record_addr[id] + 1));
+			if (r > n) {
+				n = r;
+			}
+		}
+	}
+
+	return 2 * (n + 1);
+}
+
+static uint8_t log_add(const uint8_t* data, uint8_t len) {
+	uint8_t id = free_id;
+	uint8_t index = 0;
+	uint16_t addr;
+
+	if (id == VAULT_IDS) {
+		//No room left in the index
+		return VAULT_FULL;
+	}
+
+	addr = store(id, len, data,
+			log_reserve(RECORD_HEADER + packed_length(len)) + REMOVE_RESERVE);
+	if (addr == 0) {
+		return VAULT_FULL;
+	}
+	free_id = record_addr[id] & ~ID_FREE;
+	record_addr[id] = ID_FREE;
+	set_record(id, addr);
+
+	//Passwords are listed by their id
+	while (id-- > 0) {
+		if (id_live(id)) {
+			index++;
+		}
+	}
+
+	return index;
+}
+
+static uint8_t log_remove(uint8_t index) {
+	uint8_t id = entry_id(index);
+
+	if (store(id, 0, NULL, log_reserve(0)) == 0) {
+		return 0;
+	}
+	set_record(id, 0);
+
+	return 1;
+}
+
+static uint8_t log_change(uint8_t index, const uint8_t* data, uint8_t len) {
+	uint8_t id = entry_id(index);
+	uint16_t addr;
+
+	addr = store(id, len, data,
+			log_reserve(RECORD_HEADER + packed_length(len)) + REMOVE_RESERVE);
+	if (addr == 0) {
+		return 0;
+	}
+	set_record(id, addr);
+
+	return 1;
+}
+
+//Replays the log into the index and returns the number of passwords
+static uint8_t log_open(void) {
+	uint8_t len = 0;
+	uint8_t i;
+
+	//Find the newest version of every record
+	load_header();
+	log_scan();
+
+	for (i = 0; i < VAULT_IDS; i++) {
+		if (id_live(i)) {
+			len++;
+		}
 	}
 
 	return len;
 }
 
-void write_passwords(uint8_t len, char** sarray) {
-	uint16_t addr = 0;
-	uint16_t i;
+//Slot format: [format][directory A][directory B][passwords ...][layout]
+//
+//Entry N of the list is described by slot N of the directory, the slot
+//holds [offset][offset high byte][length][crc] of the password in the
+//data area, the length byte is the one of a log record. A password is
+//found without walking the ones before it.
+//The CRC-16 covers the slot and the password, a damaged password is
+//shown as such and not typed.
+//
+//A directory is [generation][count][crc][slots], it is kept in RAM and
+//a change writes it whole to the copy not in use. New passwords go to
+//room no slot of the copy in use points at, so until the generation
+//byte of the new copy is written, the last one, a reset leaves the
+//vault as it was. Boot takes the newer copy passing its CRC.
+#define VAULT_FORMAT_SLOTS	0xA6
+#define DIRECTORY_ADDRESS	1
+#define DIRECTORY_FIELDS	2
+#define DIRECTORY_HEADER	(DIRECTORY_FIELDS + 2)
+#define SLOT_COUNT			24
+#define SLOT_SIZE			5
+#define SLOT_FIELDS			3
+#define DIRECTORY_SIZE		(DIRECTORY_HEADER + SLOT_COUNT * SLOT_SIZE)
+#define DATA_START			(DIRECTORY_ADDRESS + 2 * DIRECTORY_SIZE)
+#define DATA_END			EEPROM_LAYOUT_ADDRESS
+
+typedef struct {
+	uint16_t offset;
+	uint8_t len;
+	uint16_t crc;
+} slot_t;
+
+static slot_t slots[SLOT_COUNT];
+static uint8_t slots_used;
+static uint8_t generation;
+//Copy of the directory in use, 0 or 1
+static uint8_t directory;
+
+#define directory_address(copy)	(DIRECTORY_ADDRESS + (copy) * DIRECTORY_SIZE)
+//Bytes a slot takes in the data area
+#define slot_size(slot)			packed_length(slots[slot].len)
+
+//Adds the slot fields and the password to a checksum
+static uint16_t slot_crc(uint16_t crc, uint16_t offset, uint8_t len) {
+	crc = crc16_update(crc, offset & 0xFF);
+	crc = crc16_update(crc, offset >> 8);
+	crc = crc16_update(crc, len);
+	return crc;
+}
+
+//Points a slot at a password already written
+static void slot_set(uint8_t slot, uint16_t offset, uint8_t len) {
+	slots[slot].offset = offset;
+	slots[slot].len = len;
+	slots[slot].crc = crc_bytes(slot_crc(CRC16_INIT, offset, len), offset,
+			packed_length(len));
+}
+
+static uint8_t slot_valid(uint8_t slot) {
+	uint16_t offset = slots[slot].offset;
+	uint8_t n = slot_size(slot);
+
+	if ((offset < DATA_START) || (offset + n > DATA_END)
+			|| (n > PASSWORD_MAX_LENGTH)) {
+		return 0;
+	}
+
+	return crc_bytes(slot_crc(CRC16_INIT, offset, slots[slot].len), offset, n)
+			== slots[slot].crc;
+}
+
+//Writes the directory in RAM to the copy not in use, the generation
+//byte goes last and makes it the one in use
+static void directory_commit(void) {
+	uint16_t addr;
+	uint16_t crc = CRC16_INIT;
+	uint8_t i;
+
+	directory ^= 1;
+	generation++;
+	addr = directory_address(directory);
+
+	crc = crc16_update(crc, generation);
+	crc = crc16_update(crc, slots_used);
+	for (i = 0; i < slots_used; i++) {
+		crc = slot_crc(crc, slots[i].offset, slots[i].len);
+		crc = crc16_update(crc, slots[i].crc & 0xFF);
+		crc = crc16_update(crc, slots[i].crc >> 8);
+	}
+
+	//Written in address order up to the generation byte
+	write_byte(addr + 1, slots_used);
+	write_crc(addr + DIRECTORY_FIELDS, crc);
+	for (i = 0; i < slots_used; i++) {
+		uint16_t at = addr + DIRECTORY_HEADER + i * SLOT_SIZE;
+
+		write_byte(at, slots[i].offset & 0xFF);
+		write_byte(at + 1, slots[i].offset >> 8);
+		write_byte(at + 2, slots[i].len);
+		write_crc(at + SLOT_FIELDS, slots[i].crc);
+	}
+	write_byte(addr, generation);
+}
+
+//Returns 1 if the directory copy passes its CRC
+static uint8_t directory_valid(uint8_t copy) {
+	uint16_t addr = directory_address(copy);
+	uint8_t count = read_byte(addr + 1);
+
+	if (count > SLOT_COUNT) {
+		return 0;
+	}
+
+	return crc_bytes(crc_bytes(CRC16_INIT, addr, DIRECTORY_FIELDS),
+			addr + DIRECTORY_HEADER, count * SLOT_SIZE)
+			== read_crc(addr + DIRECTORY_FIELDS);
+}
+
+//Returns 1 if no password is stored in the n bytes at 'at'
+static uint8_t slots_free(uint16_t at, uint8_t n) {
+	uint8_t i;
 
-	//Write fixed hash value
-	eeprom_busy_wait();
-	eeprom_update_byte((uint8_t*) (addr++), EEPROM_HASH);
+	for (i = 0; i < slots_used; i++) {
+		if ((at < slots[i].offset + slot_size(i))
+				&& (slots[i].offset < at + n)) {
+			return 0;
+		}
+	}
 
-	//Write total number of passwords
-	eeprom_busy_wait();
-	eeprom_update_byte((uint8_t*) (addr++), len);
+	return 1;
+}
+
+//Returns the lowest address where n bytes fit in the data area, 0 if
+//they do not. A gap starts at the beginning of the area or right
+//behind a password.
+static uint16_t slots_find(uint8_t n) {
+	uint16_t at = DATA_START;
+	uint16_t lowest = 0;
+	uint8_t i = 0;
 
-	for (i = 0; i < len; i++) {
-		//Write number of characters in the password
-		uint8_t nr = eeprom_write_string(sarray[i], (uint8_t*) (addr + 1));
-		//Write the password itself
-		eeprom_busy_wait();
-		eeprom_update_byte((uint8_t*) addr, nr);
-		addr += 1 + nr;
+	for (;;) {
+		if ((at + n <= DATA_END) && ((lowest == 0) || (at < lowest))
+				&& slots_free(at, n)) {
+			lowest = at;
+		}
+		if (i == slots_used) {
+			return lowest;
+		}
+		at = slots[i].offset + slot_size(i);
+		i++;
 	}
 }
+
+//Moves passwords down into gaps they fit in whole, so the free room
+//joins at the end. A password is copied before its slot is committed,
+//a gap smaller than the password is left as it is.
+static void slots_compact(void) {
+	uint16_t at;
+	uint8_t moved = 1;
+	uint8_t i;
+	uint8_t j;
+
+	while (moved) {
+		moved = 0;
+		for (i = 0; i < slots_used; i++) {
+			at = slots_find(slot_size(i));
+			if ((at != 0) && (at < slots[i].offset)) {
+				for (j = 0; j < slot_size(i); j++) {
+					write_byte(at + j, read_byte(slots[i].offset + j));
+				}
+				slot_set(i, at, slots[i].len);
+				directory_commit();
+				moved = 1;
+			}
+		}
+	}
+}
+
+//Returns where a password of n bytes can be written, compacting the
+//data area if the free room is split
+static uint16_t slots_place(uint8_t n) {
+	uint16_t at = slots_find(n);
+
+	if (at == 0) {
+		slots_compact();
+		at = slots_find(n);
+	}
+
+	return at;
+}
+
+//Writes the n bytes of a password to the data area
+static void slots_write(uint16_t at, const uint8_t* data, uint8_t n) {
+	while (n-- > 0) {
+		write_byte(at++, *data++);
+	}
+}
+
+static uint8_t slots_add(const uint8_t* data, uint8_t len) {
+	uint8_t n = packed_length(len);
+	uint16_t at;
+
+	if (slots_used == SLOT_COUNT) {
+		return VAULT_FULL;
+	}
+	at = slots_place(n);
+	if (at == 0) {
+		return VAULT_FULL;
+	}
+
+	slots_write(at, data, n);
+	slot_set(slots_used++, at, len);
+	directory_commit();
+
+	return slots_used - 1;
+}
+
+static uint8_t slots_remove(uint8_t index) {
+	uint8_t i;
+
+	//Close the gap in the directory
+	for (i = index; i < slots_used - 1; i++) {
+		slots[i] = slots[i + 1];
+	}
+	slots_used--;
+	directory_commit();
+
+	return 1;
+}
+
+static uint8_t slots_change(uint8_t index, const uint8_t* data, uint8_t len) {
+	uint8_t n = packed_length(len);
+	uint16_t at;
+
+	//The new password goes to free room, the old one stays where it is
+	//until the slot points away from it
+	at = slots_place(n);
+	if (at == 0) {
+		return 0;
+	}
+
+	slots_write(at, data, n);
+	slot_set(index, at, len);
+	directory_commit();
+
+	return 1;
+}
+
+static uint8_t slots_open(void) {
+	uint8_t valid = directory_valid(0) | (directory_valid(1) << 1);
+	uint16_t addr;
+	uint8_t i;
+
+	directory = 0;
+	if (valid == 3) {
+		//Both hold, the newer one was committed last
+		directory = ((int8_t) (read_byte(directory_address(1))
+				- read_byte(directory_address(0))) > 0);
+	} else if (valid == 2) {
+		directory = 1;
+	}
+
+	slots_used = 0;
+	generation = 0;
+	if (valid != 0) {
+		addr = directory_address(directory);
+		generation = read_byte(addr);
+		slots_used = read_byte(addr + 1);
+		for (i = 0; i < slots_used; i++) {
+			uint16_t at = addr + DIRECTORY_HEADER + i * SLOT_SIZE;
+
+			slots[i].offset = read_byte(at) | (read_byte(at + 1) << 8);
+			slots[i].len = read_byte(at + 2);
+			slots[i].crc = read_crc(at + SLOT_FIELDS);
+		}
+	}
+
+	return slots_used;
+}
+
+static void slots_format(void) {
+	slots_used = 0;
+	//Both copies are made valid, the second one is the newer
+	directory_commit();
+	directory_commit();
+	write_byte(FORMAT_ADDRESS, VAULT_FORMAT_SLOTS);
+}
+
+//Format of the vault in use, read from its first byte
+static uint8_t format;
+
+//Opens the vault and returns the number of passwords, the passwords
+//themselves stay in EEPROM
+uint8_t read_passwords(void) {
+	format = read_byte(FORMAT_ADDRESS);
+	unconverted = 0;
+
+	if ((format == EEPROM_HASH) || (format == VAULT_FORMAT_CONVERTING)
+			|| ((format != VAULT_FORMAT_LOG) && (format != VAULT_FORMAT_SLOTS)
+					&& (header_valid(RESCUE_ADDRESS)
+							|| legacy_started(format)))) {
+		//Convert the vault of the previous firmware once. A format byte
+		//torn while the conversion turned it over leaves the old count or
+		//the rescue header to go on with. A vault the log has no room for
+		//stays as it is
+		unconverted = legacy_convert();
+		format = (unconverted != 0) ? EEPROM_HASH : VAULT_FORMAT_LOG;
+	} else if ((format != VAULT_FORMAT_LOG)
+			&& (format != VAULT_FORMAT_SLOTS)) {
+		//EEPROM is corrupt
+		//Consider no passwords stored
+#if VAULT_USE_SLOTS
+		slots_format();
+		format = VAULT_FORMAT_SLOTS;
+#else
+		log_format(LOG_START);
+		format = VAULT_FORMAT_LOG;
+#endif
+	}
+
+	if (format == EEPROM_HASH) {
+		return unconverted;
+	}
+	if (format == VAULT_FORMAT_SLOTS) {
+		return slots_open();
+	}
+	return log_open();
+}
+
+//Returns the number of passwords served from the vault of the previous
+//firmware, they are converted once the log has room for all of them
+uint8_t unconverted_passwords(void) {
+	return unconverted;
+}
+
+//Starts reading a stored password, packed ones are unpacked on the fly
+void password_open(uint8_t index, pack_reader_t* r) {
+	uint16_t addr;
+	uint8_t live;
+
+	if (format == VAULT_FORMAT_SLOTS) {
+		pack_open(r, slots[index].offset, slots[index].len);
+	} else if (format == EEPROM_HASH) {
+		addr = legacy_walk(index, &live);
+		pack_open(r, addr + 1, read_byte(addr));
+	} else {
+		addr = record_addr[entry_id(index)];
+		pack_open(r, addr + RECORD_HEADER, read_byte(addr + 1));
+	}
+}
+
+//Copies a password to s, which has room for PASSWORD_MAX_LENGTH
+//characters and the terminator
+void read_password(uint8_t index, char* s) {
+	pack_reader_t r;
+	uint8_t i;
+
+	password_open(index, &r);
+	//Whatever the EEPROM holds, the copy is terminated
+	for (i = 0; i < PASSWORD_MAX_LENGTH; i++) {
+		s[i] = pack_getc(&r);
+		if (s[i] == '\0') {
+			break;
+		}
+	}
+	s[i] = '\0';
+}
+
+//Returns the place of the new password in the list
+uint8_t add_password(char* s) {
+	uint8_t data[PASSWORD_MAX_LENGTH + 1];
+	uint8_t len = encode(s, data);
+
+	if (format == EEPROM_HASH) {
+		//Nothing is added before the old vault is converted
+		return VAULT_FULL;
+	}
+	if (format == VAULT_FORMAT_SLOTS) {
+		return slots_add(data, len);
+	}
+	return log_add(data, len);
+}
+
+uint8_t remove_password(uint8_t index) {
+	if (format == EEPROM_HASH) {
+		legacy_remove(index);
+		if (unconverted == 0) {
+			format = VAULT_FORMAT_LOG;
+			log_open();
+		}
+		return 1;
+	}
+	if (format == VAULT_FORMAT_SLOTS) {
+		return slots_remove(index);
+	}
+	return log_remove(index);
+}
+
+uint8_t change_password(uint8_t index, char* s) {
+	uint8_t data[PASSWORD_MAX_LENGTH + 1];
+	uint8_t len = encode(s, data);
+
+	if (format == EEPROM_HASH) {
+		return 0;
+	}
+	if (format == VAULT_FORMAT_SLOTS) {
+		return slots_change(index, data, len);
+	}
+	return log_change(index, data, len);
+}
+
+//Returns 0 for a password failing its CRC, it should not be typed. The
+//log leaves out damaged records at boot.
+uint8_t password_valid(uint8_t index) {
+	if (format == VAULT_FORMAT_SLOTS) {
+		return slot_valid(index);
+	}
+	return 1;
+}
+
+//Programs the EEPROM and drops old versions at the tail of the
+//log a record at a time while it is getting full, call it when nothing
+//else is going on. It waits for the previous step to be programmed.
+void storage_poll(void) {
+	ee_poll();
+	if ((format == VAULT_FORMAT_LOG) && !ee_pending()
+			&& (log_free(head) < COMPACT_THRESHOLD)
+			&& (LOG_SIZE - log_free(head) > live_bytes)) {
+		compact_step();
+	}
+}
+
+//Returns 1 if the EEPROM did not take some of what was written since the
+//last call, the vault may then have lost changes
+uint8_t storage_failed(void) {
+	return ee_failed();
+}
+
+//Reads the host keyboard layout id, an erased EEPROM gives 0xFF
+uint8_t read_layout(void) {
+	return ee_read_byte(EEPROM_LAYOUT_ADDRESS);
+}
+
+void write_layout(uint8_t layout) {
+	ee_write_byte(EEPROM_LAYOUT_ADDRESS, layout);
+}
@@ -1,12 +1,36 @@
 #ifndef STORAGE_H_
 #define STORAGE_H_
 
-uint16_t eeprom_write_string(char* s, uint8_t* addr);
+#include <stdint.h>
+#include "packing.h"
 
-uint16_t eeprom_read_string(char* s, uint8_t* addr);
+uint8_t read_passwords(void);
 
-uint8_t read_passwords(char*** passwords);
+uint8_t unconverted_passwords(void);
 
-void write_passwords(uint8_t len, char** sarray);
+void read_password(uint8_t index, char* s);
+
+//Returned by add_password() when there is no room left
+#define VAULT_FULL			UINT8_MAX
+
+//Returns the place of the new password in the list
+uint8_t add_password(char* s);
+
+//Returns 0 if there is no room left for the removal
+uint8_t remove_password(uint8_t index);
+
+uint8_t change_password(uint8_t index, char* s);
+
+uint8_t password_valid(uint8_t index);
+
+void password_open(uint8_t index, pack_reader_t* r);
+
+void storage_poll(void);
+
+uint8_t storage_failed(void);
+
+uint8_t read_layout(void);
+
+void write_layout(uint8_t layout);
 
 #endif /* STORAGE_H_ */
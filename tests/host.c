@@ -0,0 +1,215 @@
+//The typing code of the firmware built for the host, with a model of
+//the USB host reading the reports. A test includes this file and types
+//messages through the real report queue and pump
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../config.h"
+//A test may be built with other settings than the firmware
+#ifdef TEST_KEYS_PER_REPORT
+#undef KEYS_PER_REPORT
+#define KEYS_PER_REPORT		TEST_KEYS_PER_REPORT
+#endif
+#include "../packing.c"
+#include "../typing.c"
+
+#define MESSAGE_SIZE	256
+
+//The message being typed stands in for the EEPROM
+static uint8_t message[MESSAGE_SIZE];
+
+uint8_t ee_read_byte(uint16_t addr) {
+	return message[addr % MESSAGE_SIZE];
+}
+
+static uint16_t now_ms;
+
+uint16_t timer_ms(void) {
+	return now_ms;
+}
+
+//The driver holds one report until the host polls the endpoint
+usbTxStatus_t usbTxStatus1, usbTxStatus3;
+static keyboard_report_t sent;
+
+void usbSetInterrupt(uchar* data, uchar len) {
+	memcpy(&sent, data, len);
+	usbTxLen1 = len;
+}
+
+//Stands for the time usbPoll() takes, if a test needs it
+static void (*host_usb_poll)(void);
+
+void usbPoll(void) {
+	if (host_usb_poll != NULL) {
+		host_usb_poll();
+	}
+}
+
+//What the host typed and how it got the reports
+static char typed[MESSAGE_SIZE];
+static uint8_t typed_len;
+static unsigned long host_reports;
+static unsigned long host_keys;
+static uint8_t host_most_keys;
+static uint8_t host_caps;
+static uint8_t host_layout;
+static keyboard_report_t held;
+static uint8_t dead;
+
+#define check(cond) do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+//Character of a key with the modifiers held, from the layout table
+//turned around. 0 for a key the layout does not type
+static uint8_t host_char(uint8_t usage, uint8_t modifier, uint8_t* is_dead) {
+	uint8_t ch;
+	uint8_t entry;
+
+	*is_dead = 0;
+	if (usage == KEY_TAB) {
+		return '\t';
+	}
+	if (usage == KEY_ENTER) {
+		return '\n';
+	}
+	for (ch = LAYOUT_FIRST_CHAR; ch <= LAYOUT_LAST_CHAR; ch++) {
+		entry = layouts[ch - LAYOUT_FIRST_CHAR][host_layout][0];
+		if ((layouts[ch - LAYOUT_FIRST_CHAR][host_layout][1] == usage)
+				&& ((entry & ~MOD_DEAD) == modifier)) {
+			*is_dead = entry & MOD_DEAD;
+			return ch;
+		}
+	}
+	return 0;
+}
+
+//A key of the report that was not held in the one before is typed
+static void host_key(uint8_t usage, uint8_t modifier) {
+	uint8_t is_dead;
+	uint8_t ch = host_char(usage, 0, &is_dead);
+
+	//Caps Lock inverts shift for the keys of letters, AltGr is left alone
+	if (host_caps && !(modifier & MOD_ALTGR)
+			&& (ch >= 'a') && (ch <= 'z')) {
+		modifier ^= MOD_SHIFT;
+	}
+	ch = host_char(usage, modifier, &is_dead);
+	check(ch != 0);
+	check(typed_len < MESSAGE_SIZE - 1);
+
+	if (dead) {
+		//Only a space types the accent of a dead key on its own
+		check(ch == ' ');
+		ch = dead;
+		dead = 0;
+	} else if (is_dead) {
+		dead = ch;
+		return;
+	}
+	typed[typed_len++] = ch;
+}
+
+//The host polls the interrupt endpoint
+static void host_poll(void) {
+	uint8_t keys = 0;
+	uint8_t i;
+	uint8_t j;
+
+	if (usbInterruptIsReady()) {
+		return;
+	}
+	usbTxLen1 = USBPID_NAK;
+
+	//Frames that only steer the pump never reach the host
+	check(sent.reserved == 0);
+	host_reports++;
+	for (i = 0; i < sizeof(sent.keycode) && sent.keycode[i]; i++) {
+		//A key pressed twice in one report is typed once
+		for (j = 0; j < i; j++) {
+			check(sent.keycode[j] != sent.keycode[i]);
+		}
+		for (j = 0; j < sizeof(held.keycode); j++) {
+			if (held.keycode[j] == sent.keycode[i]) {
+				break;
+			}
+		}
+		if (j == sizeof(held.keycode)) {
+			//The keys are typed in array order
+			check((held.keycode[0] == 0) || (held.modifier == sent.modifier));
+			host_key(sent.keycode[i], sent.modifier);
+			keys++;
+		}
+	}
+	host_keys += keys;
+	if (keys > host_most_keys) {
+		host_most_keys = keys;
+	}
+	held = sent;
+}
+
+//Starts typing the bytes of s through the firmware, stored packed when
+//asked
+static void host_type_start(const char* s, uint8_t packed) {
+	pack_reader_t r;
+	uint8_t len = 0;
+
+	if (packed) {
+		len = pack_string(s, message);
+	}
+	if (len == 0) {
+		len = strlen(s);
+		memcpy(message, s, len);
+	}
+
+	typed_len = 0;
+	dead = 0;
+	usbTxLen1 = USBPID_NAK;
+	pack_open(&r, 0, len);
+	typing_start(&r);
+}
+
+//Lets a millisecond go by with the host polling every poll ms
+static void host_step(uint8_t poll) {
+	now_ms++;
+	typing_fill();
+	if (TIMSK & _BV(OCIE2)) {
+		TIMER2_COMP_vect();
+	}
+	if (now_ms % poll == 0) {
+		host_poll();
+	}
+	typed[typed_len] = '\0';
+}
+
+//Types the bytes of s through the firmware, stored packed when asked,
+//with the host polling every poll ms. Returns what the host typed
+static const char* host_type(const char* s, uint8_t packed, uint8_t poll) {
+	uint16_t quiet = 0;
+	uint16_t start = now_ms;
+
+	host_type_start(s, packed);
+
+	//Until the host had the time to poll the last frame
+	while (quiet < 20 * poll) {
+		host_step(poll);
+		quiet = typing_busy() ? 0 : quiet + 1;
+		check((uint16_t) (now_ms - start) < 60000);
+	}
+
+	//Everything is released at the end
+	check(held.keycode[0] == 0);
+	check(dead == 0);
+	return typed;
+}
+
+static void host_start(uint8_t id) {
+	typing_init();
+	typing_set_layout(id);
+	host_layout = id;
+	now_ms = 1;
+}
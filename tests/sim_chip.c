@@ -0,0 +1,238 @@
+#include <avr/io.h>
+#include <util/twi.h>
+#include "sim_chip.h"
+
+//Model of a 24LC series EEPROM on the TWI and a 25LC series one on the
+//SPI. Both take a two byte address, buffer the bytes of a page write
+//and program them when the transfer ends. While programming the I2C
+//chip does not acknowledge its address and the SPI chip sets WIP.
+
+//Polls the chip stays busy for after a page write
+#define BUSY_POLLS		3
+
+//Bit 1 of TWCR is unused, the model sets it so a write of the firmware
+//is told apart from what the model left there
+#define TWCR_MODEL		0x02
+
+//Chip select of the SPI backend
+#define CS_PIN			PB4
+
+uint8_t sim_chip[SIM_CHIP_SIZE];
+unsigned long sim_chip_pages;
+unsigned long sim_chip_bytes;
+unsigned long sim_chip_wrapped;
+unsigned long sim_chip_transactions;
+unsigned long sim_chip_nacks;
+uint8_t sim_chip_missing;
+
+volatile uint8_t TWDR, TWSR;
+static volatile uint8_t twcr = TWCR_MODEL;
+static volatile uint8_t spdr_out, spdr_in, spsr;
+
+static uint8_t page_size = 32;
+static uint8_t nack_rate;
+static uint32_t noise = 1;
+
+//Address pointer, page buffer and what the transfer has got so far
+static uint16_t pointer;
+static uint8_t buffer[128];
+static uint8_t buffered;
+static uint16_t received;
+static uint8_t busy;
+
+static void chip_select_changed(uint8_t port);
+
+void sim_chip_reset(uint8_t page, uint8_t rate) {
+	page_size = page;
+	nack_rate = rate;
+	sim_chip_pages = 0;
+	sim_chip_bytes = 0;
+	sim_chip_wrapped = 0;
+	sim_chip_transactions = 0;
+	sim_chip_nacks = 0;
+	busy = 0;
+	//The SPI chip sees its select change on the next access to PORTB
+	sim_portb_hook = chip_select_changed;
+}
+
+//Programs the buffered bytes from the pointer, wrapping round within
+//the page as the chips do
+static void program(void) {
+	uint16_t page = pointer - pointer % page_size;
+	uint8_t i;
+
+	if (buffered == 0) {
+		return;
+	}
+	if (pointer % page_size + buffered > page_size) {
+		sim_chip_wrapped++;
+	}
+	for (i = 0; i < buffered; i++) {
+		sim_chip[page + (pointer + i) % page_size] = buffer[i];
+	}
+	sim_chip_pages++;
+	sim_chip_bytes += buffered;
+	buffered = 0;
+	busy = BUSY_POLLS;
+}
+
+//Bytes written to the chip after the command or the bus address
+static void chip_write(uint8_t value) {
+	if (received == 0) {
+		pointer = value << 8;
+	} else if (received == 1) {
+		pointer |= value;
+	} else if (buffered < page_size) {
+		buffer[buffered++] = value;
+	}
+	received++;
+}
+
+static uint8_t chip_read(void) {
+	return sim_chip[pointer++ % SIM_CHIP_SIZE];
+}
+
+//I2C: 0 before the address, then the direction it gave
+enum { TWI_IDLE, TWI_ADDRESS, TWI_WRITE, TWI_READ };
+static uint8_t twi_state;
+
+static uint8_t nack(void) {
+	noise = noise * 1103515245 + 12345;
+	if ((nack_rate != 0) && ((noise >> 16) % nack_rate == 0)) {
+		sim_chip_nacks++;
+		return 1;
+	}
+	return 0;
+}
+
+static void twi_execute(uint8_t command) {
+	if (command & _BV(TWSTO)) {
+		if (twi_state == TWI_WRITE) {
+			program();
+		}
+		twi_state = TWI_IDLE;
+		twcr = TWCR_MODEL | _BV(TWEN);
+		return;
+	}
+	if (command & _BV(TWSTA)) {
+		TWSR = (twi_state == TWI_IDLE) ? TW_START : TW_REP_START;
+		if (twi_state == TWI_WRITE) {
+			//A repeated start ends a write without programming it
+			buffered = 0;
+		}
+		twi_state = TWI_ADDRESS;
+		sim_chip_transactions++;
+	} else if (twi_state == TWI_ADDRESS) {
+		uint8_t read = TWDR & TW_READ;
+
+		if (sim_chip_missing || ((TWDR & 0xFE) != 0xA0) || (busy != 0)
+				|| (read && (TWSR == TW_REP_START) && nack())) {
+			if (busy != 0) {
+				busy--;
+			}
+			TWSR = read ? TW_MR_SLA_NACK : TW_MT_SLA_NACK;
+			twi_state = TWI_IDLE;
+		} else {
+			TWSR = read ? TW_MR_SLA_ACK : TW_MT_SLA_ACK;
+			twi_state = read ? TWI_READ : TWI_WRITE;
+			received = 0;
+			buffered = 0;
+		}
+	} else if (twi_state == TWI_WRITE) {
+		chip_write(TWDR);
+		TWSR = TW_MT_DATA_ACK;
+	} else if (twi_state == TWI_READ) {
+		TWDR = chip_read();
+		TWSR = (command & _BV(TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+	} else {
+		//Nothing on the bus answers
+		TWSR = TW_MT_SLA_NACK;
+	}
+	twcr = TWCR_MODEL | _BV(TWINT) | _BV(TWEN);
+}
+
+volatile uint8_t* sim_twcr(void) {
+	if (!(twcr & TWCR_MODEL)) {
+		//Written by the firmware since
+		twi_execute(twcr);
+	}
+	return &twcr;
+}
+
+//SPI: the instruction and where the chip select is
+#define CMD_READ		0x03
+#define CMD_WRITE		0x02
+#define CMD_WREN		0x06
+#define CMD_RDSR		0x05
+
+static uint8_t selected;
+static uint8_t instruction;
+static uint8_t write_enabled;
+static uint8_t spi_pending;
+
+static void chip_select_changed(uint8_t port) {
+	uint8_t now = !(port & _BV(CS_PIN));
+
+	if (now && !selected) {
+		instruction = 0;
+		received = 0;
+		buffered = 0;
+		sim_chip_transactions++;
+	} else if (!now && selected) {
+		if (instruction == CMD_WREN) {
+			write_enabled = 1;
+		} else if ((instruction == CMD_WRITE) && write_enabled) {
+			program();
+			write_enabled = 0;
+		}
+	}
+	selected = now;
+}
+
+static uint8_t spi_exchange(uint8_t value) {
+	chip_select_changed(PORTB);
+	if (!selected) {
+		return 0xFF;
+	}
+	if (instruction == 0) {
+		instruction = value;
+		return 0xFF;
+	}
+	switch (instruction) {
+	case CMD_RDSR:
+		if (busy != 0) {
+			busy--;
+			return 0x01 | (write_enabled << 1);
+		}
+		return write_enabled << 1;
+	case CMD_READ:
+		if (received < 2) {
+			chip_write(value);
+			return 0xFF;
+		}
+		return chip_read();
+	case CMD_WRITE:
+		chip_write(value);
+		return 0xFF;
+	}
+	return 0xFF;
+}
+
+//SPDR is written, SPSR polled, then SPDR read for every byte
+volatile uint8_t* sim_spdr(void) {
+	if (spsr & _BV(SPIF)) {
+		spsr &= ~_BV(SPIF);
+		return &spdr_in;
+	}
+	spi_pending = 1;
+	return &spdr_out;
+}
+
+volatile uint8_t* sim_spsr(void) {
+	if (spi_pending) {
+		spi_pending = 0;
+		spdr_in = spi_exchange(spdr_out);
+		spsr |= _BV(SPIF);
+	}
+	return &spsr;
+}
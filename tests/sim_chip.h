@@ -0,0 +1,27 @@
+#ifndef SIM_CHIP_H_
+#define SIM_CHIP_H_
+
+#include <stdint.h>
+
+//The largest chips the backends drive, 24LC512 and 25LC512
+#define SIM_CHIP_SIZE		65536UL
+
+//Contents of the external EEPROM
+extern uint8_t sim_chip[SIM_CHIP_SIZE];
+//Page writes, the bytes they programmed and those that wrapped round
+//inside their page, which a real chip does silently
+extern unsigned long sim_chip_pages;
+extern unsigned long sim_chip_bytes;
+extern unsigned long sim_chip_wrapped;
+//Bus transactions, from a start condition or a chip select
+extern unsigned long sim_chip_transactions;
+//Repeated starts the model did not acknowledge
+extern unsigned long sim_chip_nacks;
+//Set, the I2C chip is taken off the bus and nothing answers there
+extern uint8_t sim_chip_missing;
+
+//Sets the page size and clears the counts, the contents stay. One in
+//nack_rate repeated starts is not acknowledged, 0 never
+void sim_chip_reset(uint8_t page, uint8_t nack_rate);
+
+#endif /* SIM_CHIP_H_ */
@@ -0,0 +1,71 @@
+#include <avr/io.h>
+#include "sim_eeprom.h"
+
+//Model of the EEPROM of the ATmega16. A byte is programmed at once when
+//the firmware next looks at EECR after starting it
+
+uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+unsigned long sim_eeprom_wear[SIM_EEPROM_SIZE];
+unsigned long sim_eeprom_writes;
+jmp_buf sim_power_cut;
+
+volatile uint16_t EEAR;
+static volatile uint8_t eecr;
+static volatile uint8_t eedr;
+static long cut_after = -1;
+static uint32_t noise = 1;
+
+void sim_eeprom_reset(void) {
+	eecr = 0;
+	eedr = 0;
+	EEAR = 0;
+	SREG = 0;
+	cut_after = -1;
+}
+
+void sim_eeprom_cut(long n) {
+	cut_after = n;
+}
+
+uint8_t sim_eeprom_torn(uint8_t old, uint8_t new) {
+	noise = noise * 1103515245 + 12345;
+	return (old & new) | ((noise >> 16) & ~(old & new));
+}
+
+static void program(void) {
+	uint16_t addr = EEAR % SIM_EEPROM_SIZE;
+
+	eecr &= ~(_BV(EEWE) | _BV(EEMWE));
+	if (cut_after == 0) {
+		cut_after = -1;
+		sim_eeprom[addr] = sim_eeprom_torn(sim_eeprom[addr], eedr);
+		longjmp(sim_power_cut, 1);
+	}
+	if (cut_after > 0) {
+		cut_after--;
+	}
+	sim_eeprom[addr] = eedr;
+	sim_eeprom_wear[addr]++;
+	sim_eeprom_writes++;
+}
+
+//Finishes what the firmware started
+static void settle(void) {
+	if (eecr & _BV(EERE)) {
+		eecr &= ~_BV(EERE);
+		eedr = sim_eeprom[EEAR % SIM_EEPROM_SIZE];
+	}
+	if (eecr & _BV(EEWE)) {
+		program();
+	}
+}
+
+volatile uint8_t* sim_eecr(void) {
+	settle();
+	return &eecr;
+}
+
+volatile uint8_t* sim_eedr(void) {
+	settle();
+	return &eedr;
+}
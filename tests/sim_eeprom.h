@@ -0,0 +1,29 @@
+#ifndef SIM_EEPROM_H_
+#define SIM_EEPROM_H_
+
+#include <setjmp.h>
+#include <stdint.h>
+
+#define SIM_EEPROM_SIZE		512
+
+//Contents of the EEPROM and how many times each byte was programmed
+extern uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+extern unsigned long sim_eeprom_wear[SIM_EEPROM_SIZE];
+//Bytes programmed in all
+extern unsigned long sim_eeprom_writes;
+
+//Taken by the byte programmed when the power is cut
+extern jmp_buf sim_power_cut;
+
+//Clears the registers as a reset does, the contents stay
+void sim_eeprom_reset(void);
+
+//Cuts the power while the byte after n more is being programmed, it is
+//left torn and the model jumps to sim_power_cut. A negative n never cuts
+void sim_eeprom_cut(long n);
+
+//Returns a torn byte: the bits old and new agree on are kept, any other
+//bit may end up set
+uint8_t sim_eeprom_torn(uint8_t old, uint8_t new);
+
+#endif /* SIM_EEPROM_H_ */
@@ -0,0 +1,26 @@
+#include <avr/io.h>
+
+//Registers nothing models, the code under test just reads back what it
+//wrote
+volatile uint8_t PORTA, PINA, DDRA;
+volatile uint8_t PINB, DDRB;
+volatile uint8_t PORTC, PINC, DDRC;
+volatile uint8_t PORTD, PIND, DDRD;
+volatile uint8_t GICR, GIFR, MCUCR, MCUCSR;
+volatile uint8_t TCCR0, TCNT0, OCR0, TCCR2, TCNT2, OCR2, TIMSK, TIFR;
+volatile uint8_t TCCR1A, TCCR1B;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t SPCR, TWBR;
+volatile uint8_t SREG;
+
+unsigned long sim_flash_reads;
+
+static volatile uint8_t portb;
+void (*sim_portb_hook)(uint8_t port);
+
+volatile uint8_t* sim_portb(void) {
+	if (sim_portb_hook != NULL) {
+		sim_portb_hook(portb);
+	}
+	return &portb;
+}
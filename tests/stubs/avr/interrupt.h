@@ -0,0 +1,14 @@
+#ifndef AVR_INTERRUPT_H_
+#define AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+//A handler is a plain function the tests call when the model says the
+//interrupt fires
+#define ISR(vector, ...)	void vector(void)
+#define ISR_NOBLOCK
+
+#define sei()	(SREG |= _BV(SREG_I))
+#define cli()	(SREG &= ~_BV(SREG_I))
+
+#endif /* AVR_INTERRUPT_H_ */
@@ -0,0 +1,102 @@
+#ifndef AVR_IO_H_
+#define AVR_IO_H_
+
+//Registers of the ATmega16 for the host tests. Plain variables unless a
+//model in the tests acts on them, those go through an accessor that lets
+//the model catch up first
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define _BV(bit)		(1 << (bit))
+#define bit_is_set(reg, bit)	((reg) & _BV(bit))
+#define bit_is_clear(reg, bit)	(!((reg) & _BV(bit)))
+
+extern volatile uint8_t PORTA, PINA, DDRA;
+extern volatile uint8_t PINB, DDRB;
+extern volatile uint8_t PORTC, PINC, DDRC;
+extern volatile uint8_t PORTD, PIND, DDRD;
+extern volatile uint8_t GICR, GIFR, MCUCR, MCUCSR;
+extern volatile uint8_t TCCR0, TCNT0, OCR0, TCCR2, TCNT2, OCR2, TIMSK, TIFR;
+extern volatile uint8_t TCCR1A, TCCR1B;
+extern volatile uint16_t TCNT1, OCR1A;
+extern volatile uint8_t SPCR, TWBR;
+extern volatile uint8_t SREG;
+
+//Called with the value of PORTB before every access, sim_chip.c watches
+//its chip select there
+extern void (*sim_portb_hook)(uint8_t port);
+volatile uint8_t* sim_portb(void);
+#define PORTB	(*sim_portb())
+
+//Internal EEPROM, sim_eeprom.c
+volatile uint8_t* sim_eecr(void);
+volatile uint8_t* sim_eedr(void);
+extern volatile uint16_t EEAR;
+#define EECR	(*sim_eecr())
+#define EEDR	(*sim_eedr())
+
+//TWI and SPI, sim_chip.c
+volatile uint8_t* sim_twcr(void);
+volatile uint8_t* sim_spdr(void);
+volatile uint8_t* sim_spsr(void);
+extern volatile uint8_t TWDR, TWSR;
+#define TWCR	(*sim_twcr())
+#define SPDR	(*sim_spdr())
+#define SPSR	(*sim_spsr())
+
+enum { PA0, PA1, PA2, PA3, PA4, PA5, PA6, PA7 };
+enum { PB0, PB1, PB2, PB3, PB4, PB5, PB6, PB7 };
+enum { PC0, PC1, PC2, PC3, PC4, PC5, PC6, PC7 };
+enum { PD0, PD1, PD2, PD3, PD4, PD5, PD6, PD7 };
+
+#define INT2	5
+#define INT0	6
+#define INT1	7
+#define INTF2	5
+#define ISC2	6
+
+#define CS00	0
+#define CS01	1
+#define CS02	2
+#define WGM01	3
+#define WGM00	6
+#define TOIE0	0
+#define OCIE0	1
+#define OCF0	1
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define WGM12	3
+#define OCIE1A	4
+#define OCF1A	4
+#define CS20	0
+#define CS21	1
+#define CS22	2
+#define WGM21	3
+#define OCIE2	7
+#define OCF2	7
+
+#define EERE	0
+#define EEWE	1
+#define EEMWE	2
+#define EERIE	3
+
+#define SPR0	0
+#define MSTR	4
+#define SPE		6
+#define SPIF	7
+#define SPI2X	0
+
+#define TWEN	2
+#define TWSTO	4
+#define TWSTA	5
+#define TWEA	6
+#define TWINT	7
+
+#define SREG_I	7
+
+#define E2END	511
+#define RAMEND	0x45F
+
+#endif /* AVR_IO_H_ */
@@ -0,0 +1,26 @@
+#ifndef AVR_PGMSPACE_H_
+#define AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+//Flash reads are counted so a test can compare how often tables are
+//looked at
+extern unsigned long sim_flash_reads;
+
+#define PROGMEM
+#define PGM_P	const char*
+#define PSTR(s)	(s)
+
+#define pgm_read_byte(addr)	\
+	(sim_flash_reads++, *(const uint8_t*) (addr))
+#define pgm_read_word(addr)	\
+	(sim_flash_reads += 2, *(const uint16_t*) (addr))
+#define pgm_read_ptr(addr)	\
+	(sim_flash_reads += 2, *(void* const*) (addr))
+
+#define strcpy_P	strcpy
+#define strlen_P	strlen
+#define memcpy_P	memcpy
+
+#endif /* AVR_PGMSPACE_H_ */
@@ -0,0 +1,8 @@
+#ifndef UTIL_DELAY_H_
+#define UTIL_DELAY_H_
+
+//Time does not pass on its own in the tests
+#define _delay_ms(ms)	do { } while (0)
+#define _delay_us(us)	do { } while (0)
+
+#endif /* UTIL_DELAY_H_ */
@@ -0,0 +1,145 @@
+//Passwords a device holds until the vault is full, for a few kinds of
+//passwords people use, stored packed and unpacked. The format of the
+//first firmware is counted for comparison
+
+#include "vault.c"
+
+#define CORPORA			5
+
+static const char* const corpus_names[CORPORA] = { "words + digit",
+		"alnum 12", "alnum 10 + symbol", "digits 6", "printable 16" };
+
+static const char alnum[] = "abcdefghijklmnopqrstuvwxyz"
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+static void corpus_password(uint8_t corpus, char* s) {
+	uint8_t len = 0;
+	uint8_t i;
+
+	switch (corpus) {
+	case 0:
+		for (i = 0; i < 2; i++) {
+			strcpy(s + len, vault_words[vault_rand() % VAULT_WORDS]);
+			len += strlen(s + len);
+		}
+		s[0] -= 'a' - 'A';
+		s[len++] = '0' + vault_rand() % 10;
+		break;
+	case 1:
+	case 2:
+		len = (corpus == 1) ? 12 : 10;
+		for (i = 0; i < len; i++) {
+			s[i] = alnum[vault_rand() % 62];
+		}
+		if (corpus == 2) {
+			s[vault_rand() % len] = "!@#$%&*?"[vault_rand() % 8];
+		}
+		break;
+	case 3:
+		for (len = 0; len < 6; len++) {
+			s[len] = '0' + vault_rand() % 10;
+		}
+		break;
+	default:
+		for (len = 0; len < 16; len++) {
+			s[len] = ' ' + vault_rand() % 95;
+		}
+		break;
+	}
+	s[len] = '\0';
+}
+
+//[hash][count] then [length][password\0] for every password
+static uint16_t legacy_count(uint8_t corpus) {
+	char s[PASSWORD_MAX_LENGTH + 1];
+	uint16_t used = 2;
+	uint16_t n = 0;
+
+	vault_seed = 19;
+	for (;;) {
+		corpus_password(corpus, s);
+		used += strlen(s) + 2;
+		if (used > EEPROM_LAYOUT_ADDRESS) {
+			return n;
+		}
+		n++;
+	}
+}
+
+//Adds passwords of the corpus to an empty vault until it is full
+static uint16_t fill(uint8_t corpus, uint8_t slots, uint8_t packed) {
+	static entry_t list[VAULT_MAX_IDS];
+	static entry_t got[VAULT_MAX_IDS];
+	uint8_t data[PASSWORD_MAX_LENGTH + 1];
+	uint8_t n = 0;
+	uint8_t len;
+	uint8_t i;
+
+	vault_erase();
+	vault_boot();
+	if (slots) {
+		slots_format();
+	}
+	vault_settle();
+	vault_boot();
+
+	vault_seed = 19;
+	for (;;) {
+		corpus_password(corpus, list[n]);
+		//encode() as built without VAULT_PACKING when not packed
+		len = packed ? encode(list[n], data) : strlen(list[n]);
+		if (!packed) {
+			memcpy(data, list[n], len);
+		}
+		i = slots ? slots_add(data, len) : log_add(data, len);
+		if (i == VAULT_FULL) {
+			break;
+		}
+		check(i == n);
+		n++;
+		vault_settle();
+	}
+
+	check(vault_same(got, vault_list(vault_boot(), got), list, n));
+
+	//The reserve left in a full vault takes every removal
+	for (i = n; i > 0; i--) {
+		check(slots ? slots_remove(0) : log_remove(0));
+		vault_settle();
+	}
+	check(vault_boot() == 0);
+	return n;
+}
+
+int main(void) {
+	uint16_t legacy;
+	uint16_t plain;
+	uint16_t packed;
+	uint8_t corpus;
+	uint8_t slots;
+
+	printf("%-18s %6s  %-5s %6s %6s\n", "", "legacy", "", "plain", "packed");
+	for (corpus = 0; corpus < CORPORA; corpus++) {
+		legacy = legacy_count(corpus);
+		for (slots = 0; slots < 2; slots++) {
+			plain = fill(corpus, slots, 0);
+			packed = fill(corpus, slots, 1);
+			printf("%-18s %6d  %-5s %6d %6d\n", corpus_names[corpus], legacy,
+					slots ? "slots" : "log", plain, packed);
+			check(packed >= plain);
+			//Letters and digits take three quarters of a byte, the log
+			//holds a fifth more of them
+			if ((corpus < 2) && !slots) {
+				check(packed * 5 >= plain * 6);
+			}
+			//Digits take half a byte, the log holds as many of them as the
+			//first firmware. Other passwords take more than its length
+			//byte and terminator saved in a record and its share of the
+			//header slots and of the room kept free
+			if ((corpus == 3) && !slots) {
+				check(packed >= legacy);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,80 @@
+//Runs the vault on a model of an external EEPROM through the I2C or the
+//SPI backend, built for one of them. The I2C chip now and then ignores
+//the repeated start that turns the bus round for a read
+
+#include "vault.c"
+
+#define OPERATIONS		3000
+#define PASSWORDS		40
+
+#if STORAGE_BACKEND == BACKEND_I2C
+#define CHIP_NAME		"24LC I2C"
+#define NACK_RATE		5
+#else
+#define CHIP_NAME		"25LC SPI"
+#define NACK_RATE		0
+#endif
+
+int main(void) {
+	static entry_t list[VAULT_MAX_IDS];
+	static entry_t got[VAULT_MAX_IDS];
+	entry_t s;
+	uint8_t n = 0;
+	uint8_t i;
+	int op;
+
+	sim_chip_reset(STORAGE_PAGE, NACK_RATE);
+	vault_seed = 20;
+	vault_erase();
+	vault_boot();
+	vault_settle();
+
+	for (op = 0; op < OPERATIONS; op++) {
+		i = (n > 0) ? vault_rand() % n : 0;
+		vault_password(s, PASSWORD_MAX_LENGTH);
+		if (n < PASSWORDS) {
+			i = add_password(s);
+			check(i <= n);
+			memmove(list[i + 1], list[i], (n - i) * sizeof(entry_t));
+			strcpy(list[i], s);
+			n++;
+		} else if (vault_rand() % 4 == 0) {
+			check(remove_password(i));
+			n--;
+			memmove(list[i], list[i + 1], (n - i) * sizeof(entry_t));
+		} else {
+			check(change_password(i, s));
+			strcpy(list[i], s);
+		}
+		vault_settle();
+		check(vault_same(got, vault_list(n, got), list, n));
+		if (op % 100 == 0) {
+			check(vault_same(got, vault_list(vault_boot(), got), list, n));
+		}
+	}
+
+	printf("%s, %d bytes: %lu page writes of %.1f bytes, "
+			"%lu transactions, %lu NACKs\n", CHIP_NAME, STORAGE_SIZE,
+			sim_chip_pages, (double) sim_chip_bytes / sim_chip_pages,
+			sim_chip_transactions, sim_chip_nacks);
+	//A page write never runs past the end of its page
+	check(sim_chip_wrapped == 0);
+	check(sim_chip_nacks > 0 || NACK_RATE == 0);
+	check(!storage_failed());
+
+#if STORAGE_BACKEND == BACKEND_I2C
+	//Without the chip the firmware reads it as erased and reports the
+	//writes it loses rather than waiting for it, the vault is still there
+	//once the chip is back
+	sim_chip_missing = 1;
+	check(vault_boot() == 0);
+	vault_password(s, PASSWORD_MAX_LENGTH);
+	add_password(s);
+	vault_settle();
+	check(storage_failed());
+	sim_chip_missing = 0;
+	check(vault_same(got, vault_list(vault_boot(), got), list, n));
+	check(!storage_failed());
+#endif
+	return 0;
+}
@@ -0,0 +1,268 @@
+//Cuts the power while each byte of a change is programmed, and checks
+//the vault comes back after the reset with the passwords it had before
+//the change or with those it has after it, never anything else
+
+#include "vault.c"
+
+#define STEPS			1500
+#define PASSWORDS		20
+#define LEGACY_IMAGES	200
+
+static entry_t before[VAULT_MAX_IDS];
+static entry_t after[VAULT_MAX_IDS];
+static entry_t got[VAULT_MAX_IDS];
+static entry_t again[VAULT_MAX_IDS];
+static uint8_t image[SIM_EEPROM_SIZE];
+static unsigned long cuts;
+
+//A change made up at random, done the same way on every try
+static uint8_t change_kind;
+static uint8_t change_index;
+static entry_t change_password_s;
+
+static void make_change(uint8_t n) {
+	change_kind = (n < PASSWORDS / 2) ? 0 : vault_rand() % 3;
+	if (n >= PASSWORDS) {
+		change_kind = 1 + vault_rand() % 2;
+	}
+	change_index = (n > 0) ? vault_rand() % n : 0;
+	if (n == 0) {
+		change_kind = 0;
+	}
+	vault_password(change_password_s, PASSWORD_MAX_LENGTH);
+}
+
+//Boots the vault saved in image, makes the change and lets the main
+//loop finish it. A cut power is caught here, the contents of the EEPROM
+//are what the cut left
+static uint8_t try_change(long cut) {
+	memcpy(sim_eeprom, image, sizeof(image));
+	if (setjmp(sim_power_cut)) {
+		return 0;
+	}
+	vault_reset();
+	sim_eeprom_cut(cut);
+	read_passwords();
+	if (change_kind == 0) {
+		add_password(change_password_s);
+	} else if (change_kind == 1) {
+		remove_password(change_index);
+	} else {
+		change_password(change_index, change_password_s);
+	}
+	vault_settle();
+	sim_eeprom_cut(-1);
+	return 1;
+}
+
+//Boots what a cut left, the boot itself is not cut
+static uint8_t recover(void) {
+	uint8_t n;
+
+	sim_eeprom_cut(-1);
+	n = vault_list(vault_boot(), got);
+	vault_settle();
+	return n;
+}
+
+//Makes the change on the vault in image, which holds the nb passwords
+//in before, and cuts the power at every byte it programs. The vault
+//after the change is left in image, returns its number of passwords
+static uint8_t cut_change(const char* name, int step, uint8_t nb) {
+	unsigned long writes;
+	uint8_t na;
+	uint8_t ng;
+	long k;
+
+	//The change without a cut gives the new passwords and the number of
+	//bytes it programs, the boot included
+	writes = sim_eeprom_writes;
+	check(try_change(-1));
+	writes = sim_eeprom_writes - writes;
+	na = recover();
+	memcpy(after, got, sizeof(after));
+
+	for (k = 0; k < (long) writes; k++) {
+		check(!try_change(k));
+		ng = recover();
+		cuts++;
+		if (!vault_same(got, ng, before, nb)
+				&& !vault_same(got, ng, after, na)) {
+			printf("%s step %d: cut at byte %ld of %lu lost the vault\n",
+					name, step, k, writes);
+			exit(1);
+		}
+		//The next boot finds the same
+		check(vault_same(again, vault_list(vault_boot(), again), got, ng));
+	}
+
+	//Go on from the vault after the change
+	try_change(-1);
+	memcpy(image, sim_eeprom, sizeof(image));
+	return na;
+}
+
+static void run(uint8_t slots) {
+	unsigned long start = cuts;
+	uint8_t nb;
+	int step;
+
+	vault_seed = 18 + slots;
+	vault_erase();
+	vault_boot();
+	if (slots) {
+		slots_format();
+	}
+	vault_settle();
+	memcpy(image, sim_eeprom, sizeof(image));
+
+	for (step = 0; step < STEPS; step++) {
+		memcpy(sim_eeprom, image, sizeof(image));
+		nb = vault_list(vault_boot(), before);
+		make_change(nb);
+		cut_change(slots ? "slots" : "log", step, nb);
+		check(!slots == (image[0] == VAULT_FORMAT_LOG));
+	}
+	printf("%-6s %lu cuts over %d changes, all recovered\n",
+			slots ? "slots" : "log", cuts - start, STEPS);
+}
+
+//A vault of the first firmware: [hash][count][length][password\0]...,
+//a removed password has the top bit of its length set. Passwords of len
+//characters fill it, or of random lengths with some removed when len is 0
+static void legacy_image(uint16_t room, uint8_t len) {
+	uint16_t addr = 2;
+	uint8_t count = 0;
+	uint8_t n;
+	uint8_t i;
+
+	memset(image, 0xFF, sizeof(image));
+	for (;;) {
+		n = (len != 0) ? len : 1 + vault_rand() % 20;
+		if (addr + n + 2 > room) {
+			break;
+		}
+		image[addr] = n + 1;
+		if ((len == 0) && (vault_rand() % 5 == 0)) {
+			image[addr] |= 0x80;
+		}
+		for (i = 0; i < n; i++) {
+			image[addr + 1 + i] = ' ' + vault_rand() % 95;
+		}
+		image[addr + 1 + n] = '\0';
+		addr += n + 2;
+		count++;
+	}
+	image[0] = EEPROM_HASH;
+	image[1] = count;
+}
+
+//Lists the passwords of the legacy vault in image
+static uint8_t legacy_list(entry_t* list) {
+	uint16_t addr = 2;
+	uint8_t n = 0;
+	uint8_t i;
+
+	for (i = 0; i < image[1]; i++) {
+		if (!(image[addr] & 0x80)) {
+			strcpy(list[n++], (const char*) &image[addr + 1]);
+		}
+		addr += 1 + (image[addr] & 0x7F);
+	}
+	return n;
+}
+
+//Boots the vault in image, it has the n passwords in list. Those left in
+//the legacy vault are all reported
+static void legacy_check(const entry_t* list, uint8_t n) {
+	memcpy(sim_eeprom, image, sizeof(image));
+	check(vault_same(got, vault_list(vault_boot(), got), list, n));
+	vault_flush();
+	if (sim_eeprom[0] == EEPROM_HASH) {
+		check(unconverted_passwords() == n);
+	} else {
+		check(sim_eeprom[0] == VAULT_FORMAT_LOG);
+		check(unconverted_passwords() == 0);
+	}
+}
+
+//The conversion of a legacy vault at the first boot is cut at every
+//byte, and the boot after it once more at a random byte. A vault the
+//log has no room for is kept and reported, and its passwords are then
+//removed one by one with a cut at every byte, until it converts
+static void run_legacy(void) {
+	//Full vaults of the first firmware
+	static const uint8_t full[] = { 10, 6, 16 };
+	unsigned long start = cuts;
+	unsigned long writes;
+	uint8_t converted = 0;
+	uint8_t nr;
+	uint8_t ng;
+	long k;
+	int i;
+
+	vault_seed = 31;
+	for (i = 0; i < LEGACY_IMAGES; i++) {
+		if (i < (int) sizeof(full)) {
+			legacy_image(EEPROM_LAYOUT_ADDRESS, full[i]);
+		} else {
+			legacy_image((i % 4 == 0) ? EEPROM_LAYOUT_ADDRESS
+					: 40 + vault_rand() % 460, 0);
+		}
+		nr = legacy_list(before);
+		memcpy(sim_eeprom, image, sizeof(image));
+		writes = sim_eeprom_writes;
+		check(vault_same(after, vault_list(vault_boot(), after), before, nr));
+		vault_settle();
+		writes = sim_eeprom_writes - writes;
+
+		for (k = 0; k < (long) writes; k++) {
+			memcpy(sim_eeprom, image, sizeof(image));
+			if (!setjmp(sim_power_cut)) {
+				vault_reset();
+				sim_eeprom_cut(k);
+				read_passwords();
+				vault_settle();
+				check(0);
+			}
+			if (!setjmp(sim_power_cut)) {
+				vault_reset();
+				sim_eeprom_cut(vault_rand() % 200);
+				read_passwords();
+				vault_settle();
+			}
+			ng = recover();
+			cuts++;
+			if (!vault_same(got, ng, after, nr)) {
+				printf("legacy image %d: cut at byte %ld of %lu lost the "
+						"vault\n", i, k, writes);
+				exit(1);
+			}
+		}
+
+		legacy_check(before, nr);
+		if (sim_eeprom[0] != EEPROM_HASH) {
+			converted++;
+			continue;
+		}
+		while (image[0] == EEPROM_HASH) {
+			change_kind = 1;
+			change_index = vault_rand() % nr;
+			ng = cut_change("legacy", i, nr);
+			nr--;
+			memmove(&before[change_index], &before[change_index + 1],
+					(nr - change_index) * sizeof(entry_t));
+			check(vault_same(after, ng, before, nr));
+			legacy_check(before, nr);
+		}
+	}
+	printf("legacy %lu cuts over %d vaults, %d converted at once\n",
+			cuts - start, LEGACY_IMAGES, converted);
+}
+
+int main(void) {
+	run(0);
+	run(1);
+	run_legacy();
+	return 0;
+}
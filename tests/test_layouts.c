@@ -0,0 +1,91 @@
+//Types every printable character through each layout table and checks
+//the host, set to the same layout, gets it back
+
+#include "host.c"
+
+static const char* const names[LAYOUT_COUNT] = { "US", "DE", "FR", "UK" };
+
+//Keys known from the layouts themselves, so a table that is merely
+//consistent with itself does not pass: character, usage, modifier
+static const uint8_t known[LAYOUT_COUNT][4][3] = {
+	{ { 'z', 0x1D, 0 }, { '@', 0x1F, MOD_SHIFT }, { '"', 0x34, MOD_SHIFT },
+			{ '\\', 0x31, 0 } },
+	{ { 'z', 0x1C, 0 }, { '@', 0x14, MOD_ALTGR }, { '"', 0x1F, MOD_SHIFT },
+			{ '-', 0x38, 0 } },
+	{ { 'a', 0x14, 0 }, { 'm', 0x33, 0 }, { '1', 0x1E, MOD_SHIFT },
+			{ '@', 0x27, MOD_ALTGR } },
+	{ { '@', 0x34, MOD_SHIFT }, { '"', 0x1F, MOD_SHIFT }, { '#', 0x32, 0 },
+			{ '\\', 0x64, 0 } },
+};
+
+static void check_table(uint8_t id) {
+	uint8_t a;
+	uint8_t b;
+	uint8_t i;
+
+	for (a = 0; a <= LAYOUT_LAST_CHAR - LAYOUT_FIRST_CHAR; a++) {
+		check(layouts[a][id][1] != 0);
+		//No two characters on the same key with the same modifiers
+		for (b = 0; b < a; b++) {
+			if ((layouts[a][id][1] == layouts[b][id][1])
+					&& ((layouts[a][id][0] & ~MOD_DEAD)
+							== (layouts[b][id][0] & ~MOD_DEAD))) {
+				printf("%s: '%c' and '%c' share a key\n", names[id],
+						a + LAYOUT_FIRST_CHAR, b + LAYOUT_FIRST_CHAR);
+				exit(1);
+			}
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		a = known[id][i][0] - LAYOUT_FIRST_CHAR;
+		check(layouts[a][id][1] == known[id][i][1]);
+		check((layouts[a][id][0] & ~MOD_DEAD) == known[id][i][2]);
+	}
+}
+
+static void round_trip(const char* s) {
+	if (strcmp(host_type(s, 0, 1), s) != 0) {
+		printf("%s: typed \"%s\" for \"%s\"\n", names[host_layout], typed, s);
+		exit(1);
+	}
+}
+
+int main(void) {
+	char all[LAYOUT_LAST_CHAR - LAYOUT_FIRST_CHAR + 2];
+	char one[2] = { 0, 0 };
+	uint8_t id;
+	uint8_t ch;
+	uint8_t dead_keys;
+
+	for (ch = LAYOUT_FIRST_CHAR; ch <= LAYOUT_LAST_CHAR; ch++) {
+		all[ch - LAYOUT_FIRST_CHAR] = ch;
+	}
+	all[sizeof(all) - 1] = '\0';
+
+	for (id = 0; id < LAYOUT_COUNT; id++) {
+		host_start(id);
+		check_table(id);
+
+		dead_keys = 0;
+		for (ch = LAYOUT_FIRST_CHAR; ch <= LAYOUT_LAST_CHAR; ch++) {
+			one[0] = ch;
+			round_trip(one);
+			if (layouts[ch - LAYOUT_FIRST_CHAR][id][0] & MOD_DEAD) {
+				dead_keys++;
+			}
+		}
+
+		//All of them in one message, packed into shared reports, and
+		//again with Caps Lock on
+		round_trip(all);
+		host_caps = 1;
+		typing_set_leds(LED_CAPS_LOCK);
+		round_trip(all);
+		host_caps = 0;
+		typing_set_leds(0);
+
+		printf("%s: %d characters, %d on dead keys\n", names[id],
+				LAYOUT_LAST_CHAR - LAYOUT_FIRST_CHAR + 1, dead_keys);
+	}
+	return 0;
+}
@@ -0,0 +1,106 @@
+//Measures the time between the frames the host gets while the main loop
+//is busy with usbPoll() and the LCD. The pump hands out a frame for
+//every host poll, so there is no gap longer than the poll period
+
+#include "host.c"
+
+#define MESSAGES		300
+
+static uint32_t now_us;
+static uint8_t poll;
+static uint8_t pump_pending;
+static uint32_t last_frame;
+static unsigned long max_gap_us;
+static unsigned long frames;
+
+static uint32_t seed = 8;
+
+static uint32_t random_below(uint32_t n) {
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % n;
+}
+
+//Lets us microseconds pass. The timer compare of the pump comes every
+//ms and waits while the pump is masked, the host polls every poll ms
+static void advance(uint32_t us) {
+	while (us-- > 0) {
+		if (pump_pending && (TIMSK & _BV(OCIE2))) {
+			pump_pending = 0;
+			TIMER2_COMP_vect();
+		}
+		now_us++;
+		now_ms = now_us / 1000;
+		if (now_us % 1000 == 0) {
+			pump_pending = 1;
+		}
+		if ((now_us % (poll * 1000) == 0) && !usbInterruptIsReady()) {
+			if (typing_busy() || (sent.keycode[0] != 0)) {
+				if ((last_frame != 0) && (now_us - last_frame > max_gap_us)) {
+					max_gap_us = now_us - last_frame;
+				}
+				last_frame = now_us;
+				frames++;
+			}
+			host_poll();
+		}
+	}
+}
+
+//usbPoll() runs with the pump masked, a setup packet takes a while
+static void busy_usb(void) {
+	advance(20 + random_below(300));
+}
+
+//Types a message with the main loop of the firmware running meanwhile,
+//the LCD keeps it busy for up to 5 ms now and then
+static void type_busy(const char* s) {
+	pack_reader_t r;
+	uint8_t len = strlen(s) + 1;
+
+	memcpy(message, s, len);
+	typed_len = 0;
+	last_frame = 0;
+	usbTxLen1 = USBPID_NAK;
+	pack_open(&r, 0, len);
+	typing_start(&r);
+
+	while (typing_busy() || (held.keycode[0] != 0)) {
+		typing_usb_poll();
+		typing_fill();
+		advance(50 + random_below(100));
+		if (random_below(10) == 0) {
+			advance(1000 + random_below(4000));
+		}
+	}
+	typed[typed_len] = '\0';
+	check(strcmp(typed, s) == 0);
+}
+
+int main(void) {
+	static const uint8_t polls[] = { 1, 2, 8, 10 };
+	char s[PASSWORD_MAX_LENGTH + 1];
+	uint8_t i;
+	uint8_t j;
+	int m;
+
+	host_start(LAYOUT_US);
+	host_usb_poll = busy_usb;
+	for (i = 0; i < sizeof(polls); i++) {
+		poll = polls[i];
+		max_gap_us = 0;
+		frames = 0;
+		for (m = 0; m < MESSAGES; m++) {
+			for (j = 0; j < PASSWORD_MAX_LENGTH; j++) {
+				s[j] = ' ' + random_below(95);
+			}
+			s[j] = '\0';
+			type_busy(s);
+			//The pump measures the same
+			check(typing_max_gap() <= poll);
+		}
+		printf("poll %2d ms: %6lu frames, longest gap %2lu.%03lu ms\n", poll,
+				frames, max_gap_us / 1000, max_gap_us % 1000);
+		check(max_gap_us <= poll * 1000UL);
+	}
+	return 0;
+}
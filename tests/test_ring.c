@@ -0,0 +1,177 @@
+//Runs the INT2 interrupt in one thread, clocking in scancodes bit by
+//bit, and kb_try_get() in another. Throttled to the free room of the
+//rings every key has to come out in order. Flat out the keys that come
+//out are still in order and the lost counters account for the others
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include "../keyboard.c"
+
+#define KEYS			1000000
+#define BURSTS			5000
+#define BURST			150
+
+uint16_t timer_ms(void) {
+	return 0;
+}
+
+#define check(cond) do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+//Keys that type a character of their own without shift
+static uint8_t codes[SCANCODES];
+static uint8_t chars[SCANCODES];
+static uint8_t keys;
+
+//Set by the producer when a burst is sent, by the consumer when it is
+//all taken
+static volatile int sent_burst;
+static volatile int taken_burst;
+//Keys the consumer has taken while throttled
+static volatile unsigned long taken_keys;
+
+//Clocks a frame in: start bit, 8 data bits from the lowest, odd parity
+//and stop bit, the interrupt comes on every falling clock edge
+static void clock_in(uint8_t sc) {
+	uint8_t parity = 1;
+	uint8_t bit;
+
+	PINB = 0;
+	INT2_vect();
+	for (bit = 0; bit < 8; bit++) {
+		PINB = ((sc >> bit) & 1) << DATA_PIN;
+		parity ^= (sc >> bit) & 1;
+		INT2_vect();
+	}
+	PINB = parity << DATA_PIN;
+	INT2_vect();
+	PINB = 1 << DATA_PIN;
+	INT2_vect();
+}
+
+static void* producer(void* arg) {
+	unsigned long i;
+	int b;
+
+	for (i = 0; i < KEYS; i++) {
+		//A key press is the make code alone, there is no release to lose.
+		//Each one waits in raw or as a character in kb_buffer
+		while (i - taken_keys >= KB_BUFFER_SIZE) {
+			sched_yield();
+		}
+		clock_in(codes[i % keys]);
+	}
+	sent_burst = 0;
+	while (taken_burst != 0) {
+		sched_yield();
+	}
+
+	for (b = 1; b <= BURSTS; b++) {
+		for (i = 0; i < BURST; i++) {
+			clock_in(codes[i % keys]);
+			//Let the consumer in at some point of the burst
+			if ((i * 7 + b) % 23 == 0) {
+				sched_yield();
+			}
+		}
+		sent_burst = b;
+		while (taken_burst != b) {
+			sched_yield();
+		}
+	}
+	return arg;
+}
+
+//Takes the keys of the producer, slowly now and then
+static void* consumer(void* arg) {
+	unsigned long next = 0;
+	unsigned long in_order = 0;
+	unsigned long delay;
+	unsigned long lost_total = 0;
+	unsigned long got;
+	uint8_t c;
+	int b;
+
+	//Every key comes out, in order
+	while (next < KEYS) {
+		if (kb_try_get(&c)) {
+			check(c == chars[next % keys]);
+			next++;
+			taken_keys = next;
+		} else {
+			sched_yield();
+		}
+	}
+	check((lost_chars == 0) && (lost_scancodes == 0));
+	taken_burst = 0;
+
+	for (b = 1; b <= BURSTS; b++) {
+		next = 0;
+		got = 0;
+		for (;;) {
+			if (kb_try_get(&c)) {
+				//In order, with keys missing in between
+				while ((next < BURST) && (chars[next % keys] != c)) {
+					next++;
+				}
+				check(next < BURST);
+				next++;
+				got++;
+				for (delay = rand() % 200; delay > 0; delay--) {
+					__asm__ __volatile__ ("" ::: "memory");
+				}
+			} else if ((sent_burst == b) && (raw_head == raw_tail)
+					&& (inpt == outpt)) {
+				break;
+			} else {
+				sched_yield();
+			}
+		}
+		//The producer waits, the counters can be read and cleared
+		check(got + lost_chars + lost_scancodes == BURST);
+		lost_total += lost_chars + lost_scancodes;
+		in_order += got;
+		lost_chars = 0;
+		lost_scancodes = 0;
+		taken_burst = b;
+	}
+	printf("%d keys throttled, all in order; %d flat out, %lu in order "
+			"and %lu counted lost\n", KEYS, BURSTS * BURST, in_order,
+			lost_total);
+	return arg;
+}
+
+int main(void) {
+	pthread_t threads[2];
+	uint8_t sc;
+
+	for (sc = 1; sc < SCANCODES; sc++) {
+		uint8_t c = pgm_read_byte(&unshifted[sc]);
+		uint8_t i;
+
+		for (i = 0; i < keys; i++) {
+			if (chars[i] == c) {
+				break;
+			}
+		}
+		if ((c != 0) && (i == keys) && (sc != 0x12) && (sc != 0x59)) {
+			codes[keys] = sc;
+			chars[keys++] = c;
+		}
+	}
+	ps2_init();
+	kb_set_input(1);
+	sent_burst = -1;
+	taken_burst = -1;
+
+	pthread_create(&threads[0], NULL, consumer, NULL);
+	pthread_create(&threads[1], NULL, producer, NULL);
+	pthread_join(threads[0], NULL);
+	pthread_join(threads[1], NULL);
+	return 0;
+}
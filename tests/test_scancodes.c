@@ -0,0 +1,161 @@
+//Generates the direct scancode tables of scancodes.h from the pairs the
+//first firmware searched, checks scancodes.h holds the same, and counts
+//the flash reads decode() makes for a key both ways.
+//Run 'test_scancodes -p' to print the tables for scancodes.h
+
+#include <stdio.h>
+#include "../keyboard.c"
+#include "scancode_pairs.h"
+
+#define TABLES			3
+//Cycles of an LPM instruction, the loop around it comes on top
+#define LPM_CYCLES		3
+
+static const char* const names[TABLES] = { "unshifted", "shifted",
+		"extended" };
+static const unsigned char (*const pairs[TABLES])[2] = { pairs_unshifted,
+		pairs_shifted, pairs_extended };
+static const unsigned char* const tables[TABLES] = { unshifted, shifted,
+		extended };
+
+uint16_t timer_ms(void) {
+	return 0;
+}
+
+#define check(cond) do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+//The first pair of a scancode is the one the search found
+static void generate(const unsigned char (*p)[2], unsigned char* table) {
+	uint8_t i;
+
+	memset(table, 0, SCANCODES);
+	for (i = 0; p[i][0] != 0; i++) {
+		check(p[i][0] < SCANCODES);
+		if (table[p[i][0]] == 0) {
+			table[p[i][0]] = p[i][1];
+		}
+	}
+}
+
+static void print(uint8_t t, const unsigned char* table) {
+	uint8_t sc;
+	uint8_t c;
+
+	printf("unsigned char %s[SCANCODES] PROGMEM=\n{\n", names[t]);
+	for (sc = 0; sc < SCANCODES; sc++) {
+		c = table[sc];
+		if (c == 0) {
+			continue;
+		}
+		if ((c >= ' ') && (c <= '~') && (c != '\'') && (c != '\\')) {
+			printf("[0x%02x] = '%c',\n", sc, c);
+		} else {
+			printf("[0x%02x] = 0x%02X,\n", sc, c);
+		}
+	}
+	printf("};\n\n");
+}
+
+//The search of the first firmware
+static uint8_t search(const unsigned char (*p)[2], uint8_t sc) {
+	uint8_t i;
+
+	for (i = 0; (pgm_read_byte(&p[i][0]) != sc) && pgm_read_byte(&p[i][0]);
+			i++)
+		;
+	if (pgm_read_byte(&p[i][0]) == sc) {
+		return pgm_read_byte(&p[i][1]);
+	}
+	return 0;
+}
+
+//Presses and releases the key of sc the way the keyboard sends it
+static uint8_t press(uint8_t t, uint8_t sc) {
+	uint8_t c = 0;
+
+	if (t == 1) {
+		decode(0x12);
+	} else if (t == 2) {
+		decode(0xE0);
+	}
+	decode(sc);
+	if (t == 2) {
+		decode(0xE0);
+	}
+	decode(0xF0);
+	decode(sc);
+	if (t == 1) {
+		decode(0xF0);
+		decode(0x12);
+	}
+	if (!kb_try_get(&c)) {
+		c = 0;
+	}
+	return c;
+}
+
+int main(int argc, char** argv) {
+	unsigned char table[SCANCODES];
+	unsigned long reads;
+	unsigned long before;
+	unsigned long after;
+	unsigned long most;
+	unsigned long keys;
+	uint8_t sc;
+	uint8_t t;
+
+	for (t = 0; t < TABLES; t++) {
+		generate(pairs[t], table);
+		if ((argc > 1) && (strcmp(argv[1], "-p") == 0)) {
+			print(t, table);
+			continue;
+		}
+		//scancodes.h is what the generator makes of the pairs
+		check(memcmp(table, tables[t], SCANCODES) == 0);
+	}
+	if (argc > 1) {
+		return 0;
+	}
+
+	//Outside the text input a key is dropped, not counted as lost
+	check(press(0, 0x1C) == 0);
+	check(lost_chars == 0);
+	kb_set_input(1);
+
+	//Every key of the tables, pressed once
+	for (t = 0; t < TABLES; t++) {
+		before = 0;
+		after = 0;
+		most = 0;
+		keys = 0;
+		for (sc = 1; sc < SCANCODES; sc++) {
+			if (tables[t][sc] == 0) {
+				continue;
+			}
+			keys++;
+			reads = sim_flash_reads;
+			check(search(pairs[t], sc) == tables[t][sc]);
+			reads = sim_flash_reads - reads;
+			before += reads;
+			if (reads > most) {
+				most = reads;
+			}
+
+			reads = sim_flash_reads;
+			check(press(t, sc) == tables[t][sc]);
+			after += sim_flash_reads - reads;
+		}
+		printf("%-9s %3lu keys: search %5.1f reads a key (%3lu at most, "
+				"%4.1f LPM cycles), table %3.1f\n", names[t], keys,
+				(double) before / keys, most,
+				(double) before * LPM_CYCLES / keys, (double) after / keys);
+		//One read a key press, none for its release
+		check(after == keys);
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+//Types random messages through the report queue and the pump and checks
+//the host gets the characters in the order of the message, however many
+//keys a report packs
+
+#include "host.c"
+
+#define MESSAGES		2000
+
+static uint32_t seed = 1;
+
+static uint8_t random_byte(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+//Printable characters, runs of letters and doubled ones to exercise the
+//splits of a report
+static void random_message(char* s) {
+	uint8_t len = 1 + random_byte() % PASSWORD_MAX_LENGTH;
+	uint8_t i;
+
+	for (i = 0; i < len; i++) {
+		switch (random_byte() % 4) {
+		case 0:
+			s[i] = ' ' + random_byte() % 95;
+			break;
+		case 1:
+			s[i] = (i > 0) ? s[i - 1] : 'x';
+			break;
+		default:
+			s[i] = 'a' + random_byte() % 26;
+			break;
+		}
+	}
+	s[len] = '\0';
+}
+
+static void type_random(uint8_t caps) {
+	static const uint8_t polls[] = { 1, 2, 8, 10 };
+	char s[PASSWORD_MAX_LENGTH + 1];
+	int i;
+
+	host_caps = caps;
+	typing_set_leds(caps ? LED_CAPS_LOCK : 0);
+	for (i = 0; i < MESSAGES; i++) {
+		random_message(s);
+		if (strcmp(host_type(s, i & 1, polls[i % 4]), s) != 0) {
+			printf("typed \"%s\" for \"%s\"\n", typed, s);
+			exit(1);
+		}
+	}
+}
+
+//Types a text entry compiled to bytecode
+static void type_compiled(const char* text, const char* expect) {
+	char s[MESSAGE_SIZE];
+
+	strcpy(s, text);
+	typing_compile(s);
+	if (strcmp(host_type(s, 0, 8), expect) != 0) {
+		printf("typed \"%s\" for \"%s\"\n", typed, text);
+		exit(1);
+	}
+}
+
+//Selects an entry while the one before waits in a pause, the new one
+//is typed right away
+static void type_over_pause(void) {
+	char s[MESSAGE_SIZE];
+	uint16_t start;
+
+	strcpy(s, "\\mab\\p9cd");
+	typing_compile(s);
+	host_type_start(s, 0);
+	for (start = now_ms; (uint16_t) (now_ms - start) < 1000;) {
+		host_step(8);
+	}
+	check(strcmp(typed, "ab") == 0);
+
+	start = now_ms;
+	check(strcmp(host_type("xy", 0, 8), "xy") == 0);
+	//The rest of the 9 s pause is dropped with the message
+	check((uint16_t) (now_ms - start) < 1000);
+}
+
+int main(void) {
+	host_start(LAYOUT_US);
+
+	type_random(0);
+	printf("%lu keys in %lu reports, up to %d a report\n", host_keys,
+			host_reports, host_most_keys);
+	check(host_most_keys == KEYS_PER_REPORT);
+	type_random(1);
+
+	//The slow profile sends one key a report, the others pack them
+	host_most_keys = 0;
+	type_compiled("\\m\\Sabcdefgh", "abcdefgh");
+	check(host_most_keys == 1);
+	type_compiled("\\m\\Sab\\Ncdef\\Fgh", "abcdefgh");
+	check(host_most_keys > 1);
+	type_compiled("\\muser\\tpass\\n", "user\tpass\n");
+
+	//A pause with the idle rate set repeats the keys sent last, the
+	//control frame of the pause never gets to the host
+	typing_set_idle(1);
+	type_compiled("\\mab\\p1cd\\p2ee", "abcdee");
+	typing_set_idle(0);
+	type_over_pause();
+
+	//Without the macro mark an entry is typed as it was typed in
+	type_compiled("CORP\\admin", "CORP\\admin");
+	type_compiled("ACME\\steve", "ACME\\steve");
+	type_compiled("C:\\dev\\build", "C:\\dev\\build");
+	type_compiled("\\m\\\\n", "\\n");
+	return 0;
+}
@@ -0,0 +1,127 @@
+//Per byte write counts of the vault formats under the same use, against
+//the format of the first firmware, which rewrote the vault from its
+//first byte on every change
+
+#include "vault.c"
+
+#define OPERATIONS		20000
+#define PASSWORDS		12
+//Cycles a byte of the ATmega16 EEPROM is specified for
+#define ENDURANCE		100000UL
+
+//Writes of the first firmware: [hash][count] then [length][password\0]
+//for every password, bytes already holding their value are skipped
+static unsigned long legacy_wear[SIM_EEPROM_SIZE];
+static uint8_t legacy[SIM_EEPROM_SIZE];
+
+static void legacy_update(uint16_t addr, uint8_t value) {
+	if (legacy[addr] != value) {
+		legacy[addr] = value;
+		legacy_wear[addr]++;
+	}
+}
+
+static void legacy_write(uint8_t n, const entry_t* list) {
+	uint16_t addr = 0;
+	uint8_t i;
+	uint8_t j;
+
+	legacy_update(addr++, EEPROM_HASH);
+	legacy_update(addr++, n);
+	for (i = 0; i < n; i++) {
+		uint8_t len = strlen(list[i]) + 1;
+
+		for (j = 0; j < len; j++) {
+			legacy_update(addr + 1 + j, list[i][j]);
+		}
+		legacy_update(addr, len);
+		addr += 1 + len;
+	}
+}
+
+static unsigned long most(const unsigned long* wear) {
+	unsigned long max = 0;
+	uint16_t i;
+
+	for (i = 0; i < SIM_EEPROM_SIZE; i++) {
+		if (wear[i] > max) {
+			max = wear[i];
+		}
+	}
+	return max;
+}
+
+//The same changes on the legacy format and on a vault, mostly changed
+//passwords, now and then one removed and another added. Returns the
+//highest write count of a byte of the vault
+static unsigned long run(uint8_t slots) {
+	static entry_t list[VAULT_MAX_IDS];
+	static entry_t got[VAULT_MAX_IDS];
+	uint8_t n = 0;
+	unsigned long op;
+
+	vault_seed = 12;
+	vault_erase();
+	memset(legacy, 0xFF, sizeof(legacy));
+	memset(legacy_wear, 0, sizeof(legacy_wear));
+	vault_boot();
+	if (slots) {
+		slots_format();
+		vault_flush();
+		vault_boot();
+	}
+	memset(sim_eeprom_wear, 0, sizeof(sim_eeprom_wear));
+
+	for (op = 0; op < OPERATIONS; op++) {
+		uint8_t i = (n > 0) ? vault_rand() % n : 0;
+
+		if (n < PASSWORDS) {
+			entry_t s;
+
+			vault_password(s, PASSWORD_MAX_LENGTH);
+			i = add_password(s);
+			check(i <= n);
+			memmove(list[i + 1], list[i], (n - i) * sizeof(entry_t));
+			strcpy(list[i], s);
+			n++;
+		} else if (vault_rand() % 8 == 0) {
+			check(remove_password(i));
+			n--;
+			memmove(list[i], list[i + 1], (n - i) * sizeof(entry_t));
+		} else {
+			vault_password(list[i], PASSWORD_MAX_LENGTH);
+			check(change_password(i, list[i]));
+		}
+		legacy_write(n, list);
+		vault_settle();
+		check(vault_same(got, vault_list(n, got), list, n));
+	}
+
+	//What the vault kept also comes back after a reset
+	check(vault_same(got, vault_list(vault_boot(), got), list, n));
+	return most(sim_eeprom_wear);
+}
+
+int main(void) {
+	unsigned long legacy_max;
+	unsigned long log_max;
+	unsigned long slots_max;
+
+	log_max = run(0);
+	legacy_max = most(legacy_wear);
+	slots_max = run(1);
+
+	printf("%d changes of %d passwords, most writes of a byte:\n",
+			OPERATIONS, PASSWORDS);
+	printf("  legacy %6lu  lasts %8lu changes\n", legacy_max,
+			ENDURANCE * OPERATIONS / legacy_max);
+	printf("  log    %6lu  lasts %8lu changes, %.1fx\n", log_max,
+			ENDURANCE * OPERATIONS / log_max, (double) legacy_max / log_max);
+	printf("  slots  %6lu  lasts %8lu changes, %.1fx\n", slots_max,
+			ENDURANCE * OPERATIONS / slots_max,
+			(double) legacy_max / slots_max);
+
+	//The log spreads its writes over the whole EEPROM
+	check(log_max * 4 < legacy_max);
+	return 0;
+}
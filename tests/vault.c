@@ -0,0 +1,151 @@
+//The vault code of the firmware built for the host on top of the EEPROM
+//model. A test includes this file, so it can clear the RAM of the
+//firmware the way a reset does
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../config.h"
+//A test may be built for an external EEPROM
+#ifdef TEST_STORAGE_BACKEND
+#undef STORAGE_BACKEND
+#undef STORAGE_SIZE
+#define STORAGE_BACKEND		TEST_STORAGE_BACKEND
+#define STORAGE_SIZE		TEST_STORAGE_SIZE
+#endif
+#include "../crc16.c"
+#include "../packing.c"
+#include "../eeprom_queue.c"
+#include "../backend_internal.c"
+#include "../backend_i2c.c"
+#include "../backend_spi.c"
+#include "../storage.c"
+#if STORAGE_BACKEND == BACKEND_INTERNAL
+#include "sim_eeprom.h"
+#define vault_memory		sim_eeprom
+#define vault_memory_reset()	sim_eeprom_reset()
+#else
+#include "sim_chip.h"
+#define vault_memory		sim_chip
+#define vault_memory_reset()
+#endif
+
+typedef char entry_t[PASSWORD_MAX_LENGTH + 1];
+
+//Wipes the EEPROM as a new chip
+static void vault_erase(void) {
+	memset(vault_memory, 0xFF, STORAGE_SIZE);
+}
+
+//Resets the firmware, whatever was still queued is lost
+static void vault_reset(void) {
+	vault_memory_reset();
+	backend_init();
+	run_head = run_tail = 0;
+	data_head = data_tail = 0;
+	sei();
+}
+
+//Starts the firmware over and returns the number of passwords found
+static uint8_t vault_boot(void) {
+	vault_reset();
+	return read_passwords();
+}
+
+//Waits until everything queued is programmed
+static void vault_flush(void) {
+	ee_flush();
+}
+
+//Programs everything queued and the log compact as
+//the main loop would while nothing else goes on
+static void vault_settle(void) {
+	uint8_t i;
+
+	for (i = 0; i < 8; i++) {
+		storage_poll();
+		vault_flush();
+	}
+}
+
+//Copies the passwords of the open vault, a damaged one reads "#BAD"
+static uint8_t vault_list(uint8_t n, entry_t* list) {
+	uint8_t i;
+
+	for (i = 0; i < n; i++) {
+		if (password_valid(i)) {
+			read_password(i, list[i]);
+		} else {
+			strcpy(list[i], "#BAD");
+		}
+	}
+	return n;
+}
+
+static uint8_t vault_same(const entry_t* a, uint8_t na, const entry_t* b,
+		uint8_t nb) {
+	uint8_t i;
+
+	if (na != nb) {
+		return 0;
+	}
+	for (i = 0; i < na; i++) {
+		if (strcmp(a[i], b[i]) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//Makes up a password like the ones people use: words with a capital and
+//a digit, random letters and digits, or random printable characters
+static uint32_t vault_seed = 1;
+
+static uint32_t vault_rand(void) {
+	vault_seed = vault_seed * 1103515245 + 12345;
+	return vault_seed >> 8;
+}
+
+//Words passwords are made of
+#define VAULT_WORDS		16
+
+static const char* const vault_words[VAULT_WORDS] = { "apple", "river",
+		"stone", "summer", "tiger", "blue", "house", "coffee", "garden",
+		"silver", "winter", "moon", "rocket", "purple", "castle", "dragon" };
+
+static void vault_password(char* s, uint8_t max) {
+	uint8_t kind = vault_rand() % 3;
+	uint8_t len = 8 + vault_rand() % 9;
+	uint8_t i = 0;
+
+	if (len > max) {
+		len = max;
+	}
+	if (kind == 0) {
+		while (i < len) {
+			const char* w = vault_words[vault_rand() % VAULT_WORDS];
+
+			while (*w && (i < len)) {
+				s[i++] = *w++;
+			}
+		}
+		s[0] -= 'a' - 'A';
+		s[len - 1] = '0' + vault_rand() % 10;
+	} else {
+		for (i = 0; i < len; i++) {
+			if (kind == 1) {
+				s[i] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+						"0123456789"[vault_rand() % 62];
+			} else {
+				s[i] = ' ' + vault_rand() % 95;
+			}
+		}
+	}
+	s[len] = '\0';
+}
+
+#define check(cond) do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
@@ -0,0 +1,33 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "config.h"
+#include "timer.h"
+
+//Compare value for a 1 ms period with the clk/64 prescaler
+#define TIMER_TOP		(F_CPU / 64 / 1000 - 1)
+
+//Milliseconds since timer_init(), wraps every 65.5 seconds
+static volatile uint16_t ticks;
+
+//Timer0 in CTC mode interrupts every millisecond
+void timer_init(void) {
+	OCR0 = TIMER_TOP;
+	TCCR0 = _BV(WGM01) | _BV(CS01) | _BV(CS00);
+	TIMSK |= _BV(OCIE0);
+}
+
+uint16_t timer_ms(void) {
+	uint16_t t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		t = ticks;
+	}
+	return t;
+}
+
+//Interrupts are enabled again right away so that the
+//cycle critical USB interrupt is never held back
+ISR(TIMER0_COMP_vect, ISR_NOBLOCK) {
+	ticks++;
+}
@@ -0,0 +1,14 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdint.h>
+
+//Keeps the compiler from moving the stores into a ring past the update
+//of its head, the other side of the ring runs in an interrupt
+#define memory_barrier()	__asm__ __volatile__ ("" ::: "memory")
+
+void timer_init(void);
+
+uint16_t timer_ms(void);
+
+#endif /* TIMER_H_ */
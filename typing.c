@@ -0,0 +1,656 @@
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "usbdrv/usbdrv.h"
+#include "config.h"
+#include "typing.h"
+#include "layouts.h"
+#include "timer.h"
+#include "packing.h"
+
+//Compare value for the 1 ms period of the report pump, clk/64
+#define PUMP_TOP		(F_CPU / 64 / 1000 - 1)
+
+//The pump interrupt is masked while the main loop resets the queue
+#define pump_pause()	(TIMSK &= ~_BV(OCIE2))
+#define pump_resume()	(TIMSK |= _BV(OCIE2))
+
+//Characters of the message decoded ahead of the ones being encoded
+#define WINDOW_SIZE		8
+
+//Number of frames in the report queue, must be a power of two
+#define QUEUE_SIZE		16
+#define QUEUE_MASK		(QUEUE_SIZE - 1)
+
+//HID usages of the control characters outside the layout tables
+#define KEY_ENTER		0x28
+#define KEY_ESC			0x29
+#define KEY_BACKSPACE	0x2A
+#define KEY_TAB			0x2B
+#define KEY_SPACE		0x2C
+#define KEY_DELETE		0x4C
+
+//Modifiers of the chord escapes
+#define MOD_CTRL		(1<<0)	//Left Control
+#define MOD_ALT			(1<<2)	//Left Alt
+#define MOD_GUI			(1<<3)	//Left GUI
+
+//Follows the backslash an entry starts with to be compiled as a macro
+#define MACRO_MARK		'm'
+
+//Length of a MACRO_DELAY step in ms
+#define DELAY_UNIT		100
+
+//Kinds of queued frames, kept in the reserved byte which is always
+//sent as 0. Control frames carry their operand in keycode[0]
+#define FRAME_KEYS		0
+#define FRAME_DELAY		1	//Pause for operand * DELAY_UNIT ms
+#define FRAME_PROFILE	2	//Switch to the speed profile in the operand
+
+//Empty frames sent back to back to measure the host polling period
+#define CALIBRATION_FRAMES	16
+
+//Host polls per frame and keys per report of each speed profile
+static const uint8_t profiles[PROFILE_COUNT][2] PROGMEM = {
+	{ 1, KEYS_PER_REPORT },
+	{ 2, KEYS_PER_REPORT },
+	{ 4, 1 },
+};
+
+//Ring of ready to send reports. head and tail run freely,
+//the number of queued frames is (head - tail).
+//The main loop only moves head, the pump interrupt only moves tail
+static keyboard_report_t queue[QUEUE_SIZE];
+static volatile uint8_t head, tail;
+
+//Reader of the characters still waiting to be encoded. They are
+//unpacked on demand, so the message is never copied to RAM, only the
+//few characters looked at ahead are kept in window
+static pack_reader_t source;
+static uint8_t window[WINDOW_SIZE];
+static uint8_t window_len;
+//Set while the message is not completely queued
+static uint8_t encoding;
+//Set after a dead key was queued, a space has to follow it
+static uint8_t dead_pending;
+//Keys packed per report by the profile being encoded
+static uint8_t keys_per_report = KEYS_PER_REPORT;
+//Last frame put in the queue, the host will see these keys held
+static keyboard_report_t last;
+
+//Frame the driver was given last and when
+static keyboard_report_t current;
+static uint16_t current_sent;
+
+//HID idle rate set by the host in 4 ms units, 0 sends reports only
+//when they change
+static volatile uint8_t idle_rate;
+
+//Host polls per frame of the profile being sent
+static uint8_t frame_polls = 1;
+//No frame is handed out until hold_length ms after hold_start
+static uint16_t hold_start, hold_length;
+
+//Measured period between two host polls of the interrupt endpoint
+static uint8_t poll_ms = USB_CFG_INTR_POLL_INTERVAL;
+//Calibration frames left to send and when the first one went out
+static uint8_t calibrating;
+static uint16_t calibration_start;
+
+//Longest time between two frames of a message and when the last one
+//went out, a gap longer than the profile pacing means typing stalled
+static uint16_t max_gap, last_sent;
+static uint8_t gap_valid;
+
+//Layout of the host keyboard, selects the column of the layout table
+static uint8_t layout = LAYOUT_US;
+//Lock states of the host from the LED output report
+static uint8_t leds;
+
+//Converts a character to a keycode and the modifier it needs
+//Returns 0 if the character can not be typed
+static uint8_t char_to_keycode(uint8_t ch, uint8_t* modifier) {
+	if (ch >= LAYOUT_FIRST_CHAR && ch <= LAYOUT_LAST_CHAR) {
+		*modifier = pgm_read_byte(&layouts[ch - LAYOUT_FIRST_CHAR][layout][0]);
+		return pgm_read_byte(&layouts[ch - LAYOUT_FIRST_CHAR][layout][1]);
+	}
+
+	*modifier = 0;
+	switch (ch) {
+	case '\t':
+		return KEY_TAB;
+	case '\n':
+		return KEY_ENTER;
+	}
+	return 0;
+}
+
+//Returns the character 'offset' places ahead in the message. Past the
+//window it looks like the end, what was packed so far is sent first
+static uint8_t source_char(uint8_t offset) {
+	while (window_len <= offset) {
+		if (window_len == WINDOW_SIZE) {
+			return 0;
+		}
+		window[window_len++] = pack_getc(&source);
+	}
+	return window[offset];
+}
+
+//Drops the first cnt characters of the window, they have been encoded
+static void source_skip(uint8_t cnt) {
+	window_len -= cnt;
+	memmove(window, window + cnt, window_len);
+}
+
+//Returns 1 if the keycode is already held in the first n slots of the report
+static uint8_t report_has_key(const keyboard_report_t* report, uint8_t n,
+		uint8_t keycode) {
+	uint8_t i;
+
+	for (i = 0; i < n; i++) {
+		if (report->keycode[i] == keycode) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//Turns the token at the start of the message into a report of its own.
+//Delays and profile changes become control frames.
+//Returns the number of bytes consumed
+static uint8_t pack_token(keyboard_report_t* report) {
+	uint8_t token = source_char(0);
+	uint8_t operand = source_char(1);
+	uint8_t ch, modifier;
+
+	if (operand == 0) {
+		//Truncated token, the terminator follows
+		return 1;
+	}
+
+	switch (token) {
+	case MACRO_KEY:
+		report->keycode[0] = operand;
+		return 2;
+
+	case MACRO_DELAY:
+		report->reserved = FRAME_DELAY;
+		report->keycode[0] = operand;
+		return 2;
+
+	case MACRO_PROFILE:
+		if (operand <= PROFILE_COUNT) {
+			report->reserved = FRAME_PROFILE;
+			report->keycode[0] = operand - 1;
+		}
+		return 2;
+
+	case MACRO_CHORD:
+		ch = source_char(2);
+		if (ch == MACRO_KEY && source_char(3) != 0) {
+			report->keycode[0] = source_char(3);
+			report->modifier = operand;
+			return 4;
+		}
+		if (ch != 0 && ch < MACRO_KEY) {
+			report->keycode[0] = char_to_keycode(ch, &modifier);
+			report->modifier = operand | (modifier & ~MOD_DEAD);
+			return 3;
+		}
+		//Nothing to hold the modifiers for
+		return 2;
+	}
+
+	//Unknown token, skip it
+	return 1;
+}
+
+//Packs the next characters of the message into one keypress report.
+//A report holds up to keys_per_report distinct keys that share the same
+//modifier; the host types them in array order.
+//dead is set when the report holds a dead key that needs a space after it
+//Returns the number of characters consumed
+static uint8_t pack_keys(keyboard_report_t* report, uint8_t* dead) {
+	uint8_t cnt = 0;
+	uint8_t n = 0;
+	uint8_t ch, keycode, modifier;
+
+	memset(report, 0, sizeof(*report));
+	*dead = 0;
+	while (n < keys_per_report && (ch = source_char(cnt)) != 0) {
+		if (ch >= MACRO_KEY) {
+			//Tokens always start a report of their own
+			if (n == 0) {
+				cnt = pack_token(report);
+			}
+			break;
+		}
+		keycode = char_to_keycode(ch, &modifier);
+		if ((leds & LED_CAPS_LOCK)
+				&& ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'))) {
+			//Caps Lock inverts shift for letters
+			modifier ^= MOD_SHIFT;
+		}
+		if (modifier & MOD_DEAD) {
+			//A dead key goes alone in its report
+			if (n == 0) {
+				report->modifier = modifier & ~MOD_DEAD;
+				report->keycode[0] = keycode;
+				*dead = 1;
+				cnt++;
+			}
+			break;
+		}
+		if (keycode != 0) {
+			//A repeated key or another modifier needs a new report
+			if (n > 0
+					&& (modifier != report->modifier
+							|| report_has_key(report, n, keycode))) {
+				break;
+			}
+			report->modifier = modifier;
+			report->keycode[n++] = keycode;
+		}
+		cnt++;
+	}
+
+	return cnt;
+}
+
+//Keys still held from the last frame would not be seen as new
+//keypresses, so everything has to be released before sending them again
+static uint8_t needs_release(const keyboard_report_t* next) {
+	uint8_t i;
+
+	if (last.keycode[0] == 0) {
+		return 0;
+	}
+	if (next->modifier != last.modifier) {
+		return 1;
+	}
+	for (i = 0; i < sizeof(next->keycode) && next->keycode[i]; i++) {
+		if (report_has_key(&last, sizeof(last.keycode), next->keycode[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void enqueue(const keyboard_report_t* report) {
+	queue[head & QUEUE_MASK] = *report;
+	memory_barrier();
+	head++;
+	if (report->reserved == FRAME_KEYS) {
+		//Control frames leave the keys as they are
+		last = *report;
+	}
+}
+
+static void enqueue_release(void) {
+	keyboard_report_t release;
+
+	memset(&release, 0, sizeof(release));
+	enqueue(&release);
+}
+
+//Starts the report pump, Timer2 in CTC mode interrupts every millisecond
+void typing_init(void) {
+	OCR2 = PUMP_TOP;
+	TCCR2 = _BV(WGM21) | _BV(CS22);
+	pump_resume();
+}
+
+void typing_set_layout(uint8_t id) {
+	if (id < LAYOUT_COUNT) {
+		layout = id;
+	}
+}
+
+//Encodes the null terminated message read by 'message' into
+//press/release frames. Frames that do not fit are encoded later
+//by typing_fill()
+void typing_start(const pack_reader_t* message) {
+	pump_pause();
+
+	//Drop what was not sent yet and release whatever the host holds
+	if (encoding || head != tail) {
+		tail = head;
+		enqueue_release();
+	}
+
+	source = *message;
+	window_len = 0;
+	encoding = 1;
+	dead_pending = 0;
+	calibrating = 0;
+	//A pause of the message before is not waited out
+	hold_length = 0;
+	keys_per_report = KEYS_PER_REPORT;
+	frame_polls = 1;
+	max_gap = 0;
+	gap_valid = 0;
+	typing_fill();
+
+	pump_resume();
+}
+
+//Tops up the report queue with the next frames of the message.
+//Called from the main loop, outside of the USB critical path
+void typing_fill(void) {
+	keyboard_report_t next;
+	uint8_t cnt, dead;
+
+	while (encoding && (uint8_t) (head - tail) < QUEUE_SIZE) {
+		if (dead_pending) {
+			//A space after a dead key types the accent itself
+			memset(&next, 0, sizeof(next));
+			next.keycode[0] = KEY_SPACE;
+			if (needs_release(&next)) {
+				enqueue_release();
+			} else {
+				enqueue(&next);
+				dead_pending = 0;
+			}
+			continue;
+		}
+		if (source_char(0) == 0) {
+			if (last.keycode[0] != 0) {
+				enqueue_release();
+			}
+			encoding = 0;
+			break;
+		}
+
+		cnt = pack_keys(&next, &dead);
+		if (next.reserved == FRAME_PROFILE) {
+			keys_per_report = pgm_read_byte(&profiles[next.keycode[0]][1]);
+			enqueue(&next);
+			source_skip(cnt);
+		} else if (next.reserved == FRAME_DELAY) {
+			//Never pause with keys held, they would start repeating
+			if (last.keycode[0] != 0) {
+				enqueue_release();
+			} else {
+				enqueue(&next);
+				source_skip(cnt);
+			}
+		} else if (next.keycode[0] == 0) {
+			//Nothing typeable, skip it
+			source_skip(cnt);
+		} else if (needs_release(&next)) {
+			enqueue_release();
+		} else {
+			enqueue(&next);
+			source_skip(cnt);
+			dead_pending = dead;
+		}
+	}
+}
+
+//Copies the next queued key frame to report. Frames are handed out no
+//faster than the speed profile allows, timed by the 1 ms timer. Control
+//frames are taken in here and never reach report, it keeps the last
+//keys sent for the idle repeats.
+//Called by the pump whenever the interrupt endpoint is free
+//Returns 0 if there is nothing to send yet
+static uint8_t next_report(keyboard_report_t* report) {
+	keyboard_report_t frame;
+	uint16_t now = timer_ms();
+
+	if (hold_length != 0) {
+		if ((uint16_t) (now - hold_start) < hold_length) {
+			return 0;
+		}
+		hold_length = 0;
+	}
+
+	while (head != tail) {
+		frame = queue[tail & QUEUE_MASK];
+		tail++;
+
+		switch (frame.reserved) {
+		case FRAME_DELAY:
+			hold_start = now;
+			hold_length = frame.keycode[0] * DELAY_UNIT;
+			//A pause is no stall
+			gap_valid = 0;
+			return 0;
+
+		case FRAME_PROFILE:
+			frame_polls = pgm_read_byte(&profiles[frame.keycode[0]][0]);
+			continue;
+		}
+		*report = frame;
+
+		//Let the host poll frame_polls - 1 times without new data
+		hold_start = now;
+		hold_length = (frame_polls - 1) * poll_ms;
+
+		if (gap_valid && (uint16_t) (now - last_sent) > max_gap) {
+			max_gap = now - last_sent;
+		}
+		last_sent = now;
+		gap_valid = 1;
+
+		if (calibrating != 0) {
+			//Frames go out back to back, one on every host poll
+			if (calibrating == CALIBRATION_FRAMES) {
+				calibration_start = now;
+			} else if (calibrating == 1) {
+				poll_ms = ((uint16_t) (now - calibration_start)
+						+ (CALIBRATION_FRAMES - 1) / 2)
+						/ (CALIBRATION_FRAMES - 1);
+				if (poll_ms == 0) {
+					poll_ms = 1;
+				}
+			}
+			calibrating--;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+//Measures how often the host polls the interrupt endpoint by sending
+//empty reports back to back. The slower profiles are paced in
+//multiples of the measured period
+void typing_calibrate(void) {
+	uint8_t i;
+
+	//The first empty frame also releases whatever the host holds
+	typing_stop();
+
+	pump_pause();
+	frame_polls = 1;
+	max_gap = 0;
+	gap_valid = 0;
+	for (i = 0; i < CALIBRATION_FRAMES; i++) {
+		enqueue_release();
+	}
+	calibrating = CALIBRATION_FRAMES;
+	pump_resume();
+}
+
+//Drops the frames that were not sent yet
+void typing_stop(void) {
+	pump_pause();
+	tail = head;
+	encoding = 0;
+	calibrating = 0;
+	hold_length = 0;
+	pump_resume();
+}
+
+uint8_t typing_busy(void) {
+	uint8_t busy;
+
+	pump_pause();
+	busy = encoding || head != tail || hold_length != 0;
+	pump_resume();
+	return busy;
+}
+
+//Returns the host polling period in ms
+uint8_t typing_poll_interval(void) {
+	return poll_ms;
+}
+
+//Returns the longest time in ms between two frames of the last message.
+//With nothing stalling the pump it is the pacing of the profile
+uint16_t typing_max_gap(void) {
+	uint16_t gap;
+
+	pump_pause();
+	gap = max_gap;
+	pump_resume();
+	return gap;
+}
+
+//Runs usbPoll() with the pump masked. usbPoll() sets the interrupt
+//endpoint state itself on a bus reset or SET_CONFIGURATION, V-USB does
+//not allow usbSetInterrupt() to run in the middle of it. Use it instead
+//of calling usbPoll() directly
+void typing_usb_poll(void) {
+	pump_pause();
+	usbPoll();
+	pump_resume();
+}
+
+//Sets the HID idle rate requested with SET_IDLE, in 4 ms units
+void typing_set_idle(uint8_t rate) {
+	idle_rate = rate;
+}
+
+//Tracks the lock states the host reports in the LED output report.
+//Letters are typed with shift inverted while Caps Lock is on
+void typing_set_leds(uint8_t state) {
+	leds = state;
+}
+
+//The report pump hands the queued frames to the driver as soon as the
+//interrupt endpoint is free, so blocking work in the main loop never
+//delays typing. Without a new frame the current report is only sent
+//again when the host set an idle rate and it expired.
+ISR(TIMER2_COMP_vect, ISR_NOBLOCK) {
+	uint16_t now;
+
+	if (!usbInterruptIsReady()) {
+		return;
+	}
+
+	now = timer_ms();
+	if (next_report(&current)
+			|| (idle_rate != 0
+					&& (uint16_t) (now - current_sent) >= idle_rate * 4)) {
+		usbSetInterrupt((void *) &current, sizeof(current));
+		current_sent = now;
+	}
+}
+
+//Compiles the escapes of a macro entry into bytecode, in place. An
+//entry is a macro when it starts with \m, the mark is dropped. Any other
+//entry is kept as it was typed in, so a DOMAIN\user login or a path
+//keeps its backslashes. The escapes of a macro are:
+//  \n Enter  \t Tab  \e Esc  \b Backspace  \d Delete
+//  \c Ctrl, \a Alt, \s Shift, \g GUI held for the next key
+//  \p pause 1 s, \p1 to \p9 pause 1 to 9 s
+//  \F fast, \N normal, \S slow typing from here on
+//  \\ a backslash
+//A backslash before anything else is kept as it is.
+//Returns the length of the bytecode
+uint8_t typing_compile(char* s) {
+	char* in = s;
+	char* out = s;
+	char* chord = NULL;
+	uint8_t ch, usage, modifier;
+
+	if ((in[0] != '\\') || (in[1] != MACRO_MARK)) {
+		return strlen(s);
+	}
+	in += 2;
+
+	while ((ch = *in++) != 0) {
+		usage = 0;
+		modifier = 0;
+
+		if (ch == '\\' && *in != 0) {
+			ch = *in++;
+			switch (ch) {
+			case 'n':
+				usage = KEY_ENTER;
+				break;
+			case 't':
+				usage = KEY_TAB;
+				break;
+			case 'e':
+				usage = KEY_ESC;
+				break;
+			case 'b':
+				usage = KEY_BACKSPACE;
+				break;
+			case 'd':
+				usage = KEY_DELETE;
+				break;
+			case 'c':
+				modifier = MOD_CTRL;
+				break;
+			case 'a':
+				modifier = MOD_ALT;
+				break;
+			case 's':
+				modifier = MOD_SHIFT;
+				break;
+			case 'g':
+				modifier = MOD_GUI;
+				break;
+			case 'p':
+				*out++ = MACRO_DELAY;
+				*out = 1000 / DELAY_UNIT;
+				if (*in >= '1' && *in <= '9') {
+					*out = (*in++ - '0') * (1000 / DELAY_UNIT);
+				}
+				out++;
+				chord = NULL;
+				continue;
+			case 'F':
+			case 'N':
+			case 'S':
+				*out++ = MACRO_PROFILE;
+				*out++ = 1 + ((ch == 'F') ? PROFILE_FAST :
+						(ch == 'N') ? PROFILE_NORMAL : PROFILE_SLOW);
+				chord = NULL;
+				continue;
+			case '\\':
+				break;
+			default:
+				//Not an escape, keep the backslash
+				*out++ = '\\';
+				break;
+			}
+		}
+
+		if (modifier != 0) {
+			//Consecutive chord escapes add up to one chord
+			if (chord != NULL) {
+				*chord |= modifier;
+			} else {
+				*out++ = MACRO_CHORD;
+				chord = out;
+				*out++ = modifier;
+			}
+			continue;
+		}
+
+		if (usage != 0) {
+			*out++ = MACRO_KEY;
+			*out++ = usage;
+		} else {
+			*out++ = ch;
+		}
+		chord = NULL;
+	}
+	*out = 0;
+
+	return out - s;
+}
@@ -0,0 +1,65 @@
+#ifndef TYPING_H_
+#define TYPING_H_
+
+#include <stdint.h>
+#include "packing.h"
+
+//Host keyboard layouts the passwords can be typed for
+#define LAYOUT_US		0
+#define LAYOUT_DE		1
+#define LAYOUT_FR		2
+#define LAYOUT_UK		3
+#define LAYOUT_COUNT	4
+
+//Tokens of the bytecode an entry is stored in. Bytes below 0x80 are
+//typed as characters, a token is followed by one operand byte
+#define MACRO_KEY		0x80	//Press the key with the HID usage in the operand
+#define MACRO_CHORD		0x81	//Hold the operand modifiers for the next key
+#define MACRO_DELAY		0x82	//Pause for operand * 100 ms
+#define MACRO_PROFILE	0x83	//Type the rest with speed profile operand - 1
+
+//Bits of the HID LED output report
+#define LED_NUM_LOCK	(1<<0)
+#define LED_CAPS_LOCK	(1<<1)
+#define LED_SCROLL_LOCK	(1<<2)
+
+//Typing speed profiles, slower ones suit hosts that drop keys
+#define PROFILE_FAST	0	//A frame on every host poll, keys packed
+#define PROFILE_NORMAL	1	//A frame every second host poll, keys packed
+#define PROFILE_SLOW	2	//A frame every fourth host poll, one key each
+#define PROFILE_COUNT	3
+
+typedef struct {
+	uint8_t modifier;
+	uint8_t reserved;
+	uint8_t keycode[6];
+} keyboard_report_t;
+
+void typing_init(void);
+
+void typing_set_layout(uint8_t id);
+
+uint8_t typing_compile(char* s);
+
+void typing_start(const pack_reader_t* message);
+
+void typing_calibrate(void);
+
+void typing_stop(void);
+
+uint8_t typing_busy(void);
+
+uint8_t typing_poll_interval(void);
+
+uint16_t typing_max_gap(void);
+
+void typing_usb_poll(void);
+
+void typing_set_idle(uint8_t rate);
+
+void typing_set_leds(uint8_t state);
+
+void typing_fill(void);
+
+
+#endif /* TYPING_H_ */